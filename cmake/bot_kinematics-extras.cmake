@@ -0,0 +1,7 @@
+# Header-only kinematics kernels without ROS, for real-time controllers:
+#   target_link_libraries(my_controller bot_kinematics::bot_kinematics)
+if(NOT TARGET bot_kinematics::bot_kinematics)
+  include(CMakeFindDependencyMacro)
+  find_dependency(Eigen3)
+  include("${moveit_bot_kinematics_plugin_DIR}/bot_kinematicsTargets.cmake")
+endif()
@@ -1,9 +1,20 @@
 #ifndef BOT_KINEMATICS_H
 #define BOT_KINEMATICS_H
 
+/*
+ *Everything in this header is meant to be callable from a real-time thread:
+ *'forward', 'forwardChain', 'inverse' and the helpers in bot_kinematics_utils.h do not allocate,
+ *do not do any I/O and do not throw. Keep it that way when you fill in your own solution
+ *(fixed size Eigen types only, no std::cout, no ROS). Printing lives in bot_kinematics_io.h.
+ */
+
 #include <Eigen/Dense>
-#include "bot_kinematics/bot_parameters.h"
+#include "bot_kinematics/bot_kinematics_math.h"
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
 
 namespace bot_kinematics
 {
@@ -19,20 +30,6 @@ namespace bot_kinematics
 		T a1, a2, a3, l1, l2, l3, t1, t3;//these are arbitrary names which you can provide as you like
 	};
 
-	/*
-	 *Function to make operator << compatible with datatypes
-	 */
-	template <typename T>
-	std::ostream& operator<<(std::ostream& os, const Parameters<T>& params)
-	{
-	  os << "Distances: [" << params.a1 << " "
-	     << params.a2 << " "
-	     << params.a3 << " " << params.l1 << " "
-	     << params.l2 << " " << params.l3 << " "
-	     << params.t1 << params.t3 << "]\n";
-	  return os;
-	}
-
 	/**
 	* Typedef equivalent to Eigen::Isometry3d for T = double and Eigen::Isometry3f for
 	* T = float.
@@ -40,132 +37,465 @@ namespace bot_kinematics
 	template <typename T>
 	using Transform = Eigen::Transform<T, 3, Eigen::Isometry>;
 
+	/*
+	 *Size of the DH chain, change these based on your bot.
+	 *number_of_frames is the number of link frames computed by 'forwardChain' (t01..t34 in this example).
+	 */
+	const int number_of_joints = 3;
+	const int number_of_frames = 4;
+
+	/*
+	 *Number of values stored per frame in flat frame buffers (a 4x4 column-major matrix).
+	 */
+	const int frame_size = 16;
+
+	/*
+	 *Maximum number of ik branches 'inverse' can return (shoulder x elbow x wrist for a 6-axis arm).
+	 */
+	const int max_solutions = 8;
+
+	/*
+	 *Trajectories shorter than this are not split over cores by 'forwardTrajectory': at about 200 ns per
+	 *waypoint they would not pay for the fork/join of an OpenMP team (256 waypoints are about 50 us of work).
+	 */
+	const std::size_t parallel_waypoints = 256;
+
+	/*
+	 *Joints that place the tip position (shoulder, elbow), the remaining ones only orient it (wrist).
+	 */
+	const int number_of_position_joints = 3;
+
+	/*
+	 *What 'inverse' has to match. The reduced modes only match the position of the tip (position), or the
+	 *position and the direction of the tip z axis with free roll about it (position_axis). They skip the
+	 *orientation terms instead of solving the full pose; joints they leave free are NaN in the output.
+	 */
+	enum class Mode
+	{
+		full,
+		position,
+		position_axis
+	};
+
 	/**
-	*to find the ik for a given pose.
+	*Fixed transforms between the frames a caller works in and the ends of the DH chain, for robots where
+	*the base or tip frame is not the DH base or tip (calibrated bases, different tools).
+	*base is the DH base in the caller's base frame, tool is the caller's tip frame in the DH tip frame.
+	*Build it once with 'makeOffsets' (again whenever the parameters change): the inverses are precomputed
+	*and the tool is folded into the constant last link of the chain, so queries do not pay for it.
 	*/
 	template <typename T>
-	void inverse(const Parameters<T>& p, const Transform<T>& pose, T* out) noexcept;
+	struct Offsets
+	{
+		Transform<T> base, base_inverse;
+		Transform<T> tool_inverse;
+		Eigen::Matrix<T, 4, 4> tail;//constant last link of the chain (t34) with the tool folded in
+		Eigen::Matrix<T, 3, 1> tool_axis;//z axis of the tip frame in the DH tip frame
+		bool identity;//base and tip frames are the DH chain ends, nothing to apply
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+
+	template <typename T>
+	Offsets<T> makeOffsets(const Parameters<T>& p, const Transform<T>& base = Transform<T>::Identity(),
+	                       const Transform<T>& tool = Transform<T>::Identity()) noexcept;
+
+	/*
+	 *All kernels below take a math policy from bot_kinematics_math.h as optional second template argument,
+	 *e.g. forward<double, FastMath>(p, qs). ExactMath (libm) is used if none is given.
+	 */
+
+	/**
+	*to find all ik branches for a given pose.
+	*out must hold max_solutions * number_of_joints values, branch b is stored at out + b * number_of_joints.
+	*returns a mask with bit b set if branch b is a valid solution; invalid branches are filled with NaN.
+	*with 'approximate' set, out of reach poses give the closest configurations instead of no solution.
+	*/
+	template <typename T, typename Math = ExactMath>
+	unsigned int inverse(const Parameters<T>& p, const Transform<T>& pose, T* out, bool approximate = false) noexcept;
+
+	/**
+	*same as above for a pose of the tip frame in the base frame described by 'o'.
+	*/
+	template <typename T, typename Math = ExactMath>
+	unsigned int inverse(const Parameters<T>& p, const Offsets<T>& o, const Transform<T>& pose, T* out,
+	                     bool approximate = false) noexcept;
+
+	/**
+	*same as above, only matching what 'mode' asks for.
+	*the reduced modes need a tool whose origin is the DH tip origin (any rotation is fine).
+	*/
+	template <typename T, typename Math = ExactMath>
+	unsigned int inverse(const Parameters<T>& p, const Offsets<T>& o, const Transform<T>& pose, Mode mode, T* out,
+	                     bool approximate = false) noexcept;
+
+	/**
+	*to find the position joints of all branches that put the DH tip at 'position' (in the DH base),
+	*the wrist joints are left NaN.
+	*/
+	template <typename T, typename Math = ExactMath>
+	unsigned int inversePosition(const Parameters<T>& p, const Eigen::Matrix<T, 3, 1>& position, T* out,
+	                             bool approximate = false) noexcept;
+
+	/**
+	*to find all branches that put the DH tip at 'position' and its 'tool_axis' (in the DH tip frame) along
+	*'axis' (in the DH base), the roll about the axis is left NaN.
+	*/
+	template <typename T, typename Math = ExactMath>
+	unsigned int inverseAxis(const Parameters<T>& p, const Eigen::Matrix<T, 3, 1>& position,
+	                         const Eigen::Matrix<T, 3, 1>& axis, const Eigen::Matrix<T, 3, 1>& tool_axis, T* out,
+	                         bool approximate = false) noexcept;
 
 	/**
 	*to find the fk for a given joint angles.
 	*/
-	template <typename T>
+	template <typename T, typename Math = ExactMath>
 	Transform<T> forward(const Parameters<T>& p, const T* qs) noexcept;
 
+	template <typename T, typename Math = ExactMath>
+	Transform<T> forward(const Parameters<T>& p, const Offsets<T>& o, const T* qs) noexcept;
+
+	/**
+	*to find the pose of every link of the DH chain for given joint angles.
+	*frames must hold number_of_frames transforms, the last one is the tip (same as 'forward').
+	*/
+	template <typename T, typename Math = ExactMath>
+	void forwardChain(const Parameters<T>& p, const T* qs, Transform<T>* frames) noexcept;
+
+	template <typename T, typename Math = ExactMath>
+	void forwardChain(const Parameters<T>& p, const Offsets<T>& o, const T* qs, Transform<T>* frames) noexcept;
+
+	/**
+	*to find the fk for a whole trajectory in one call.
+	*qs holds num_waypoints rows of number_of_joints joint angles (row-major).
+	*out receives, for every waypoint, the tip frame (or all number_of_frames frames if all_links is set)
+	*as column-major 4x4 matrices of frame_size values each, so it must hold
+	*num_waypoints * (all_links ? number_of_frames : 1) * frame_size values.
+	*/
+	template <typename T, typename Math = ExactMath>
+	void forwardTrajectory(const Parameters<T>& p, const T* qs, std::size_t num_waypoints, T* out,
+	                       bool all_links) noexcept;
+
+	template <typename T, typename Math = ExactMath>
+	void forwardTrajectory(const Parameters<T>& p, const Offsets<T>& o, const T* qs, std::size_t num_waypoints,
+	                       T* out, bool all_links) noexcept;
+
+	/*
+	 *The links of the chain, shared by both 'forwardChain's and 'makeOffsets'.
+	 *jointLinks are the ones that move with the joint angles, constantLinks the rest (t34 in this example).
+	 */
+	template <typename T, typename Math>
+	void jointLinks(const Parameters<T>& p, const T* qs, Eigen::Matrix<T, 4, 4>& t01, Eigen::Matrix<T, 4, 4>& t12,
+	                Eigen::Matrix<T, 4, 4>& t23) noexcept
+	{
+		//the below declarations depends entirely on the number of joint angles you have , in this case it is 3
+		T q[number_of_joints];
+		q[0] = qs[0];
+		q[1] = qs[1];
+		q[2] = qs[2];
+
+		//sines and cosines through the math policy, see bot_kinematics_math.h
+		T s1, s2, s3;
+		T c1, c2, c3;
+		Math::sincos(q[0], s1, c1);
+		Math::sincos(q[1], s2, c2);
+		Math::sincos(q[2], s3, c3);
+
+		//transformation matrices based on DH rule (theta, d, a, alpha), this example arm uses
+		//t01=(q1, l1, a1, 90deg), t12=(q2, 0, a2, 0), t23=(q3, 0, a3, 0) and leaves l2, l3 and t1 unused.
+		t01 << c1, 0, s1, p.a1*c1,
+			   s1, 0,-c1, p.a1*s1,
+			    0, 1,  0,    p.l1,
+			    0, 0,  0,       1;
+
+		t12 << c2,-s2, 0, p.a2*c2,
+			   s2, c2, 0, p.a2*s2,
+			    0,  0, 1,       0,
+			    0,  0, 0,       1;
+
+		t23 << c3,-s3, 0, p.a3*c3,
+			   s3, c3, 0, p.a3*s3,
+			    0,  0, 1,       0,
+			    0,  0, 0,       1;
+
+		//add more matrices if needed (and raise number_of_frames accordingly)
+	}
+
 	template <typename T>
-	void inverse(const Parameters<T>& p, const Transform<T>& pose, T* out) noexcept
+	Eigen::Matrix<T, 4, 4> constantLinks(const Parameters<T>& p) noexcept
 	{
-		using Mat = Eigen::Matrix<T, 4, 4>;
+		//t34 is the tool, t3 along the last link
+		Eigen::Matrix<T, 4, 4> t34;
+		t34 << 1,0,0,p.t3,
+			 0,1,0, 0,
+			 0,0,1, 0,
+			 0,0,0, 1;
+		return t34;
+	}
+
+	template <typename T>
+	Offsets<T> makeOffsets(const Parameters<T>& p, const Transform<T>& base, const Transform<T>& tool) noexcept
+	{
+		const Eigen::Matrix<T, 4, 4> t34=constantLinks(p);
+
+		Offsets<T> o;
+		o.identity=base.matrix().isIdentity() && tool.matrix().isIdentity();
+		o.base=base;
+		o.tool_axis=tool.linear().col(2);
+		if (o.identity)
+		{
+			o.base_inverse.setIdentity();
+			o.tool_inverse.setIdentity();
+			o.tail=t34;
+			return o;
+		}
+		o.base_inverse=base.inverse();
+		o.tool_inverse=tool.inverse();
+		o.tail=t34*tool.matrix();
+		return o;
+	}
+
+	template <typename T, typename Math>
+	unsigned int inverse(const Parameters<T>& p, const Offsets<T>& o, const Transform<T>& pose, T* out,
+	                     bool approximate) noexcept
+	{
+		if (o.identity)
+			return inverse<T, Math>(p, pose, out, approximate);
+
+		//bring the pose to the DH chain ends, the inverses were computed in 'makeOffsets'
+		return inverse<T, Math>(p, Transform<T>(o.base_inverse * pose * o.tool_inverse), out, approximate);
+	}
+
+	template <typename T, typename Math>
+	unsigned int inverse(const Parameters<T>& p, const Offsets<T>& o, const Transform<T>& pose, Mode mode, T* out,
+	                     bool approximate) noexcept
+	{
+		using Vector = Eigen::Matrix<T, 3, 1>;
 
+		if (mode == Mode::full)
+			return inverse<T, Math>(p, o, pose, out, approximate);
+
+		//only the tip position (and axis) in the DH base are needed, no rotation products
+		Vector position = pose.translation();
+		if (!o.identity)
+			position = o.base_inverse * position;
+
+		if (mode == Mode::position)
+			return inversePosition<T, Math>(p, position, out, approximate);
+
+		Vector axis = pose.linear().col(2);
+		if (!o.identity)
+			axis = o.base_inverse.linear() * axis;
+
+		return inverseAxis<T, Math>(p, position, axis, o.tool_axis, out, approximate);
+	}
+
+	template <typename T, typename Math>
+	unsigned int inverse(const Parameters<T>& p, const Transform<T>& pose, T* out, bool approximate) noexcept
+	{
 		const auto& matrix = pose.matrix();
 
-		T a1=p.a1,a2=p.a2,a3=p.a3,l1=p.l1,l2=p.l2,l3=p.l3,t1=p.t1,t3=p.t3;
+		//the position joints of every branch come from the tip position
+		unsigned int mask=inversePosition<T, Math>(p, Eigen::Matrix<T, 3, 1>(matrix(0,3),matrix(1,3),matrix(2,3)),
+		                                           out, approximate);
+
+		/*
+		 *Orientation stage: for a wrist, solve joints number_of_position_joints.. of every branch set in 'mask'
+		 *from the rotation part of 'matrix' here, and fill in the wrist flip branches (branch | 4).
+		 *The example arm has no wrist, so there is nothing to do.
+		 */
+
+		return mask;
+	}
+
+	template <typename T, typename Math>
+	unsigned int inverseAxis(const Parameters<T>& p, const Eigen::Matrix<T, 3, 1>& position,
+	                         const Eigen::Matrix<T, 3, 1>& axis, const Eigen::Matrix<T, 3, 1>& tool_axis, T* out,
+	                         bool approximate) noexcept
+	{
+		unsigned int mask=inversePosition<T, Math>(p, position, out, approximate);
 
-		T X=matrix(0,3);
-		T Y=matrix(1,3);
-		T Z=matrix(2,3);
 		/*
-		 *Write your ik solution here the x,y,z coordinates are given above.
-		 *the variable 'matrix' is 4x4 transformation matrix for position and orientation in base(world) frame.
+		 *Axis stage: for a wrist, solve the two wrist joints that turn 'tool_axis' onto 'axis' for every branch
+		 *set in 'mask' and leave the roll joint NaN. This needs only the axis, not a full rotation matrix.
+		 *The example arm has no wrist, so 'axis' and 'tool_axis' are not used.
 		 */
+		(void)axis;
+		(void)tool_axis;
+
+		return mask;
+	}
 
-		//My code for checking IK (only position is checked, use 'forward' function to check orientation also)
-		int number_of_joint_angles=2;//change the number based on your bot
-		double error_margin=pow(10,-2);// set allowed error margin
-		bool flag=false;
-		std::cout<<"error margin: "<<error_margin<<"\n";// comment if you dont want to print
+	template <typename T, typename Math>
+	unsigned int inversePosition(const Parameters<T>& p, const Eigen::Matrix<T, 3, 1>& position, T* out,
+	                             bool approximate) noexcept
+	{
+		//the tool (t3) continues the last link, so the solver sees one link of length a3+t3
+		T a1=p.a1,a2=p.a2,a3=p.a3+p.t3,l1=p.l1;
 
-		// the sines and cosines for your matrix, this example only uses only 2 joint angles and more if needed
-		T c1=cos(theta1);
-		T s1=sin(theta1);
-		T c2=cos(theta2);
-		T s2=sin(theta2);
+		T X=position(0);
+		T Y=position(1);
+		T Z=position(2);
+		/*
+		 *Write your ik solution here the x,y,z coordinates are given above (in base(world) frame).
+		 *the orientation is handled in 'inverse' and 'inverseAxis', only the position joints are solved here.
+		 *
+		 *Every branch goes into its own row of 'out': out[branch*number_of_joints + joint]=theta.
+		 *Branch index bits: bit 0 elbow (up/down), bit 1 shoulder (front/back), bit 2 wrist (flip).
+		 *Set bit 'branch' of the returned mask for every branch that is a solution, the others are left NaN.
+		 *Compute the terms that the branches share once, outside the branch loops.
+		 *
+		 *This example is the arm of 'forwardChain': a yaw joint followed by a planar two link arm (shoulder offset a1,
+		 *shoulder height l1, link lengths a2 and a3 plus the tool t3), so it has the 4 shoulder/elbow branches and
+		 *no wrist.
+		 *Solve the same chain as 'forwardChain', the round trip test in test/ checks every branch against it.
+		 *For a 6-axis arm with a spherical wrist every arm branch gives two wrist branches (theta5 and -theta5),
+		 *which go into branch | wrist_flip.
+		 */
 
-		Mat t;
-		t<< c1*c2,-c1*s2, s1,a3*c1*c2,
-			  s1*c2,-s1*s2,-c1,a3*s1*c2,
-			     s2,    c2,  0,a3*s2+a2,
-			      0,     0,  0,       1;
+		const T nan=std::numeric_limits<T>::quiet_NaN();
+		for(int i=0;i<max_solutions*number_of_joints;i++)
+			out[i]=nan;
 
+		const T error_margin=T(1e-2);// set allowed error margin
+		unsigned int mask=0;
 
-		flag=false;
+		// shared by all branches
+		const T r=std::sqrt(X*X+Y*Y);
+		const T zz=Z-l1;
+		const T theta1_front=std::atan2(Y,X);
 
-		for(int i=0;i<number_of_joint_angles;i++)
+		for(int shoulder=0;shoulder<2;shoulder++)
 		{
-			std::cout<<" error : "<<(matrix(i,3)-t(i,3))<<" ";
-			if(error_margin<fabs(matrix(i,3)-t(i,3)))
+			// reaching over the base flips the yaw by pi and mirrors the planar problem
+			const T theta1=shoulder ? (theta1_front>0 ? theta1_front-T(M_PI) : theta1_front+T(M_PI)) : theta1_front;
+			const T rr=(shoulder ? -r : r)-a1;
+
+			T d=(rr*rr+zz*zz-a2*a2-a3*a3)/(T(2)*a2*a3);
+			if(approximate && std::isfinite(d))
+				d=std::max(T(-1),std::min(T(1),d));// closest reachable point: arm fully stretched or folded
+			if(!(std::abs(d)<=T(1)))
+				continue;// out of reach (or NaN parameters) for both elbow branches
+
+			T c1, s1;
+			Math::sincos(theta1, s1, c1);
+			const T elbow_angle=std::acos(d);
+			const T sin3=std::sqrt(T(1)-d*d);// sin(elbow_angle), no trig needed
+			const T reach_angle=std::atan2(zz,rr);
+
+			for(int elbow=0;elbow<2;elbow++)
 			{
-				flag=false;
-				break;
+				const T theta3=elbow ? -elbow_angle : elbow_angle;
+				const T c3=d;// cos(theta3) is the same for both elbow branches
+				const T s3=elbow ? -sin3 : sin3;
+				const T theta2=reach_angle-std::atan2(a3*s3,a2+a3*c3);
+
+				T c2, s2;
+				Math::sincos(theta2, s2, c2);
+				const T c23=c2*c3-s2*s3;
+				const T s23=s2*c3+c2*s3;
+
+				//checking the branch (only position is checked, use 'forward' function to check orientation also)
+				const T planar=a1+a2*c2+a3*c23;
+				if(!approximate &&
+				   (error_margin<std::abs(X-c1*planar) ||
+				    error_margin<std::abs(Y-s1*planar) ||
+				    error_margin<std::abs(Z-(l1+a2*s2+a3*s23))))
+					continue;
+
+				const int branch=(shoulder<<1)|elbow;
+				T* sol=out+branch*number_of_joints;
+				sol[0]=theta1;
+				sol[1]=theta2;
+				sol[2]=theta3;
+				mask|=1u<<branch;
 			}
-			else
-				flag =true;
 		}
 
-		if(flag)
-		{
-			//the solutions are added here as out[(index of joint angle)+(how many'th solution)]=theta_i_j
-			out[0]=theta1;
-			out[1]=theta2;
-			//if you multiple solution just follow the above instruction(sorry for the awkward english!).
-		}
-		}
+		return mask;
+	}
 
-	template <typename T>
-	Transform<T> forward(const Parameters<T>& p, const T* qs) noexcept
+	template <typename T, typename Math>
+	void forwardChain(const Parameters<T>& p, const T* qs, Transform<T>* frames) noexcept
 	{
-		using Matrix = Eigen::Matrix<T, 4, 4>;
-		using Vector = Eigen::Matrix<T, 3, 1>;
-		using Rotation=const Eigen::Matrix<T, 3, 3>;
-
-		//the below declarations depends entirely on the number of joint angles you have , in this case it is 3
-		T q[3];
-		q[0] = qs[0];
-		q[1] = qs[1];
-		q[2] = qs[2];
-
-		T s1 = std::sin(q[0]);
-		T s2 = std::sin(q[1]);
-		T s3 = std::sin(q[2]);
-
-
-		T c1 = std::cos(q[0]);
-		T c2 = std::cos(q[1]);
-		T c3 = std::cos(q[2]);
+		//no base or tool offset: the plain chain, with the constant links built right here
+		Eigen::Matrix<T, 4, 4> t01, t12, t23;
+		jointLinks<T, Math>(p, qs, t01, t12, t23);
+
+		//frames are accumulated from the base, so frames[i] is the pose of link i+1 in base(world) frame
+		frames[0].matrix()=t01;
+		frames[1].matrix()=frames[0].matrix()*t12;
+		frames[2].matrix()=frames[1].matrix()*t23;
+		frames[3].matrix()=frames[2].matrix()*constantLinks(p);
+	}
 
-		//arbitrary transformation matrices based on DH rule.
-		Matrix t01;
-		t01 << c1,s1, 0, 0,
-			 s1, c1, 0, 0,
-			 0 , 0 , 1, p.l1+p.t1,
-			 0 , 0 , 1, 1;
+	template <typename T, typename Math>
+	void forwardChain(const Parameters<T>& p, const Offsets<T>& o, const T* qs, Transform<T>* frames) noexcept
+	{
+		Eigen::Matrix<T, 4, 4> t01, t12, t23;
+		jointLinks<T, Math>(p, qs, t01, t12, t23);
+
+		//the constant links are precomputed together with the tool in 'makeOffsets' (o.tail)
+		if (o.identity)
+			frames[0].matrix()=t01;
+		else
+			frames[0].matrix()=o.base.matrix()*t01;
+		frames[1].matrix()=frames[0].matrix()*t12;
+		frames[2].matrix()=frames[1].matrix()*t23;
+		frames[3].matrix()=frames[2].matrix()*o.tail;
+	}
 
-		Matrix t12;
-		t12 << s2,c2, 0, p.a1,
-			   0,  0,1,p.l2+p.l3,
-			  c2,s2, 0,  0,
-			   0,  0, 0,  1;
+	template <typename T, typename Math>
+	Transform<T> forward(const Parameters<T>& p, const T* qs) noexcept
+	{
+		Transform<T> frames[number_of_frames];
+		forwardChain<T, Math>(p, qs, frames);
 
-		Matrix t23;
-		t23 << c3,s3, 0, 0,
-		 	  0,  0,1,p.l3+p.a2+p.t1,
-		 	 s3, c3, 0, 0,
-		 	  0,  0, 0, 1;
+		return frames[number_of_frames-1];
+	}
 
-			Matrix t34;
-			t34 << 1,0,0,p.t3,
-				 0,1,0, 0,
-				 0,0,1,p.a3,
-				 0,0,0, 1;
+	template <typename T, typename Math>
+	Transform<T> forward(const Parameters<T>& p, const Offsets<T>& o, const T* qs) noexcept
+	{
+		Transform<T> frames[number_of_frames];
+		forwardChain<T, Math>(p, o, qs, frames);
 
-		//add more matrices if needed
+		return frames[number_of_frames-1];
+	}
 
-		 Matrix t04=t01*t12*t23*t34;
+	template <typename T, typename Math>
+	void forwardTrajectory(const Parameters<T>& p, const T* qs, std::size_t num_waypoints, T* out,
+	                       bool all_links) noexcept
+	{
+		//built once per trajectory, not per waypoint
+		forwardTrajectory<T, Math>(p, makeOffsets(p), qs, num_waypoints, out, all_links);
+	}
 
-		Transform<T> i;
-		i.matrix()=t04;//convert the simple 4x4 matrix to a transformation matrix (solve data type issues)
+	template <typename T, typename Math>
+	void forwardTrajectory(const Parameters<T>& p, const Offsets<T>& o, const T* qs, std::size_t num_waypoints,
+	                       T* out, bool all_links) noexcept
+	{
+		const std::size_t frames_per_waypoint = all_links ? number_of_frames : 1;
+		const std::size_t stride = frames_per_waypoint * frame_size;
+
+		//waypoints are independent, so long trajectories are split over the available cores (if built with
+		//OpenMP). the OpenMP runtime may allocate its thread pool, so call this one from planning threads only.
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static) if(num_waypoints >= parallel_waypoints)
+#endif
+		for (long i = 0; i < static_cast<long>(num_waypoints); i++)
+		{
+			Transform<T> frames[number_of_frames];
+			forwardChain<T, Math>(p, o, qs + i * number_of_joints, frames);
 
-		return i;
+			T* dst = out + i * stride;
+			const int first = all_links ? 0 : number_of_frames - 1;
+			for (int j = first; j < number_of_frames; j++, dst += frame_size)
+			{
+				Eigen::Map<Eigen::Matrix<T, 4, 4>> frame(dst);
+				frame = frames[j].matrix();
+			}
+		}
 	}
 
 
@@ -0,0 +1,26 @@
+#ifndef BOT_KINEMATICS_IO_H
+#define BOT_KINEMATICS_IO_H
+
+#include "bot_kinematics/bot_kinematics.h"
+#include <ostream>
+
+namespace bot_kinematics
+{
+	/*
+	 *Function to make operator << compatible with datatypes
+	 *(kept out of bot_kinematics.h so the kernels stay free of I/O)
+	 */
+	template <typename T>
+	std::ostream& operator<<(std::ostream& os, const Parameters<T>& params)
+	{
+	  os << "Distances: [" << params.a1 << " "
+	     << params.a2 << " "
+	     << params.a3 << " " << params.l1 << " "
+	     << params.l2 << " " << params.l3 << " "
+	     << params.t1 << params.t3 << "]\n";
+	  return os;
+	}
+
+} // end namespace bot_kinematics
+
+#endif // BOT_KINEMATICS_IO_H
@@ -2,29 +2,80 @@
 #define BOT_UTILITIES_H
 
 #include <cmath>
+#include "bot_kinematics/bot_kinematics.h"
 
 namespace bot_kinematics
 {
 
 template <typename T>
-inline bool isValid(const T* qs)
+inline bool isValid(const T* qs) noexcept
 {
-  return std::isfinite(qs[0]) && std::isfinite(qs[1]) && std::isfinite(qs[2]);
+  for (int i = 0; i < number_of_joints; i++)
+    if (!std::isfinite(qs[i]))
+      return false;
+  return true;
 }
 
+/*
+ *Check parameters before handing them to the solver, adapt this to your 'inverse'
+ *(the example divides by a2*(a3+t3), so both links need a length)
+ */
 template <typename T>
-inline void harmonizeTowardZero(T* qs)
+inline bool isValid(const Parameters<T>& p) noexcept
 {
-  const static T pi = T(M_PI);
-  const static T two_pi = T(2.0 * M_PI);
+  const T values[] = { p.a1, p.a2, p.a3, p.l1, p.l2, p.l3, p.t1, p.t3 };
+  for (int i = 0; i < 8; i++)
+    if (!std::isfinite(values[i]))
+      return false;
+  return p.a2 != T(0) && p.a3 + p.t3 != T(0);
+}
+
+/*
+ *Check branch 'branch' of the mask returned by 'inverse'
+ */
+inline bool isValid(unsigned int mask, int branch) noexcept
+{
+  return (mask >> branch) & 1u;
+}
 
-  for (int i = 0; i < 3; i++) // TODO: depends on the number of joint angles
+template <typename T>
+inline void harmonizeTowardZero(T* qs) noexcept
+{
+  // plain constants, a function local static would add a guard variable check on every call
+  const T pi = T(M_PI);
+  const T two_pi = T(2.0 * M_PI);
+
+  for (int i = 0; i < number_of_joints; i++)
   {
     if (qs[i] > pi) qs[i] -= two_pi;
     else if (qs[i] < -pi) qs[i] += two_pi;
   }
 }
 
+/*
+ *Shift every joint by whole turns to the value nearest 'seed', or if that is outside [lower, upper] to the value
+ *inside them nearest to it. Use it instead of 'harmonizeTowardZero' before checking limits: a joint at 3.2 rad
+ *is 0.1 from a seed at 3.1, but -3.08 after harmonizing toward zero. Returns false if a joint has no value
+ *inside its bounds (infinite bounds are fine).
+ */
+template <typename T>
+inline bool harmonizeToward(T* qs, const T* seed, const T* lower, const T* upper) noexcept
+{
+  const T two_pi = T(2.0 * M_PI);
+
+  for (int i = 0; i < number_of_joints; i++)
+  {
+    T q = seed[i] + std::remainder(qs[i] - seed[i], two_pi);
+    if (q < lower[i]) q += two_pi * std::ceil((lower[i] - q) / two_pi);
+    else if (q > upper[i]) q -= two_pi * std::ceil((q - upper[i]) / two_pi);
+
+    qs[i] = q;
+    if (q < lower[i] || q > upper[i])
+      return false;
+  }
+  return true;
+}
+
 }
 
 #endif // BOT_UTILITIES_H
@@ -2,10 +2,14 @@
 #define MOVEIT_BOT_KINEMATICS_PLUGIN_
 
 // ROS
+#include <random_numbers/random_numbers.h>
 #include <ros/ros.h>
 
 // System
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 
 // ROS msgs
 #include <geometry_msgs/PoseStamped.h>
@@ -21,6 +25,7 @@
 
 // Bot kinematics
 #include "bot_kinematics/bot_kinematics.h"
+#include "moveit_bot_kinematics_plugin/shm_ik_channel.h"
 
 namespace moveit_bot_kinematics_plugin
 {
@@ -67,6 +72,42 @@ public:
   virtual bool getPositionFK(const std::vector<std::string>& link_names, const std::vector<double>& joint_angles,
                              std::vector<geometry_msgs::Pose>& poses) const;
 
+  /**
+   * @brief Compute forward kinematics for a whole trajectory without going through pose messages.
+   * @param joint_trajectory num_waypoints rows of dimension_ joint values (row-major)
+   * @param num_waypoints number of rows in joint_trajectory
+   * @param frames preallocated buffer of at least getTrajectoryFKBufferSize(num_waypoints, all_links) values,
+   *        receives the tip frame (or every DH link frame if all_links is set) of each waypoint as
+   *        column-major 4x4 matrices
+   * @param all_links write all link frames of the DH chain instead of only the tip frame
+   */
+  bool getTrajectoryFK(const double* joint_trajectory, std::size_t num_waypoints, double* frames,
+                       bool all_links = false) const;
+
+  /**
+   * @brief Number of values getTrajectoryFK writes for a trajectory of num_waypoints
+   */
+  static std::size_t getTrajectoryFKBufferSize(std::size_t num_waypoints, bool all_links = false);
+
+  /**
+   * @brief Find ik solutions for poses sampled inside a goal region, in one call instead of one call per sample
+   *        (e.g. for constraint samplers). Samples are solved as they are drawn, with the joint limits and the
+   *        consistency limits checked on the whole turn of each joint nearest to the seed.
+   * @param center center of the region
+   * @param half_extents half sizes of the position box, along the axes of center
+   * @param orientation_tolerance maximum rotation angle (rad) away from the orientation of center
+   * @param sample_budget maximum number of poses to sample
+   * @param max_solutions number of solutions to return
+   * @param ik_seed_state seed, also used for joints the ik mode leaves free
+   * @param consistency_limits maximum distance of each joint from the seed, empty for none
+   * @param solutions the first max_solutions valid solutions, or the max_solutions nearest to the seed
+   * @param seed_nearest spend the whole budget and keep the solutions nearest to the seed
+   */
+  bool searchRegionIK(const geometry_msgs::Pose& center, const Eigen::Vector3d& half_extents,
+                      double orientation_tolerance, std::size_t sample_budget, std::size_t max_solutions,
+                      const std::vector<double>& ik_seed_state, const std::vector<double>& consistency_limits,
+                      std::vector<std::vector<double>>& solutions, bool seed_nearest = false) const;
+
   virtual bool initialize(const std::string& robot_description, const std::string& group_name,
                           const std::string& base_name, const std::string& tip_frame, double search_discretization)
   {
@@ -99,6 +140,30 @@ public:
                 std::vector<std::vector<double>>& solutions, KinematicsResult& result,
                 const kinematics::KinematicsQueryOptions& options = kinematics::KinematicsQueryOptions()) const;
 
+  /**
+   * @brief  Solve IK in this process, never forwarding to an IK server. Used by bot_ik_server itself.
+   */
+  bool getLocalIK(const Eigen::Affine3d& pose, std::vector<std::vector<double>>& joint_poses,
+                  bool approximate = false) const;
+
+  /**
+   * @brief  Re-read kinematics_solver_dh_parameters from the parameter server and apply them.
+   * Queries that are already running finish with the previous parameters.
+   */
+  bool reloadBotParameters();
+
+  /**
+   * @brief  Validate and apply new dh parameters, e.g. after an in-field calibration
+   */
+  bool updateBotParameters(const bot_kinematics::Parameters<double>& parameters);
+
+  /**
+   * @brief Hash of everything that decides the solutions of a query: dh parameters, base and tip frame offsets,
+   * ik mode and math policy. A shared memory IK server is only used while its fingerprint is the same, so it
+   * changes with every parameter update.
+   */
+  std::uint64_t getConfigurationFingerprint() const;
+
 protected:
   virtual bool
   searchPositionIK(const geometry_msgs::Pose& ik_pose, const std::vector<double>& ik_seed_state, double timeout,
@@ -122,11 +187,18 @@ private:
   bool isRedundantJoint(unsigned int index) const;
 
   bool setBotParameters();
+  template <typename Math>
+  void setMathPolicy();
+  bool getFixedTransform(const std::string& from, const std::string& to, Eigen::Isometry3d& transform) const;
+  bool loadBotParameters(bot_kinematics::Parameters<double>& parameters);
+  std::uint64_t computeFingerprint(const bot_kinematics::Parameters<double>& parameters) const;
+  void watchBotParameters(const ros::WallTimerEvent& event);
 
   double distance(const std::vector<double>& a, const std::vector<double>& b) const;
   std::size_t closestJointPose(const std::vector<double>& target,
                                const std::vector<std::vector<double>>& candidates) const;
-  bool getAllIK(const Eigen::Affine3d& pose, std::vector<std::vector<double>>& joint_poses) const;
+  bool getAllIK(const Eigen::Affine3d& pose, const std::vector<double>& seed_state, double timeout,
+                std::vector<std::vector<double>>& joint_poses, bool approximate) const;
   bool getIK(const Eigen::Affine3d& pose, const std::vector<double>& seed_state, std::vector<double>& joint_pose) const;
 
   bool active_; /** Internal variable that indicates whether solvers are configured and ready */
@@ -142,7 +214,98 @@ private:
 
   int num_possible_redundant_joints_;
 
-  bot_kinematics::Parameters<double> bot_parameters_;
+  bot_kinematics::Mode ik_mode_; /** What the ik has to match: full pose, position or position and tool axis */
+  std::string math_policy_;      /** kinematics_solver_math_policy the kernels below were instantiated for */
+
+  /**
+   * @brief Kernels instantiated for the math policy selected in kinematics.yaml, chosen once at initialize()
+   */
+  struct BotKernels
+  {
+    typedef bot_kinematics::Parameters<double> Parameters;
+    typedef bot_kinematics::Offsets<double> Offsets;
+
+    unsigned int (*inverse)(const Parameters&, const Offsets&, const Eigen::Isometry3d&, bot_kinematics::Mode,
+                            double*, bool);
+    Eigen::Isometry3d (*forward)(const Parameters&, const Offsets&, const double*);
+    void (*forward_trajectory)(const Parameters&, const Offsets&, const double*, std::size_t, double*, bool);
+  };
+  BotKernels kernels_;
+
+  /**
+   * @brief Everything a query derives from the dh parameters. Never modified after it is published.
+   */
+  struct BotSnapshot
+  {
+    bot_kinematics::Parameters<double> parameters;
+    bot_kinematics::Offsets<double> offsets; /** Base and tip frame offsets, derived from the parameters */
+    std::uint64_t fingerprint; /** getConfigurationFingerprint() for these parameters */
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  /**
+   * @brief Holds on to the current snapshot for the duration of a query, see snapshot_
+   */
+  class SnapshotGuard
+  {
+  public:
+    explicit SnapshotGuard(const MoveItBotKinematicsPlugin& plugin) : plugin_(plugin)
+    {
+      // counted before the load, so a snapshot is never freed between the two
+      plugin_.snapshot_readers_.fetch_add(1);
+      snapshot_ = plugin_.snapshot_.load();
+    }
+
+    ~SnapshotGuard()
+    {
+      if (plugin_.snapshot_readers_.fetch_sub(1) == 1 && plugin_.has_retired_snapshots_.load())
+        plugin_.reclaimSnapshots();
+    }
+
+    SnapshotGuard(const SnapshotGuard&) = delete;
+    SnapshotGuard& operator=(const SnapshotGuard&) = delete;
+
+    const BotSnapshot& operator*() const
+    {
+      return *snapshot_;
+    }
+
+    const BotSnapshot* operator->() const
+    {
+      return snapshot_;
+    }
+
+  private:
+    const MoveItBotKinematicsPlugin& plugin_;
+    const BotSnapshot* snapshot_;
+  };
+
+  void reclaimSnapshots() const;
+
+  // Queries read the current snapshot without locking (RCU style) through a SnapshotGuard. Replaced snapshots
+  // are retired and freed once no query is running, by the last query to finish or the next update. Only
+  // queries that overlap without a gap for as long as updates keep coming delay this.
+  std::atomic<const BotSnapshot*> snapshot_;
+  std::unique_ptr<const BotSnapshot> current_snapshot_;
+  mutable std::atomic<unsigned int> snapshot_readers_; /** Queries holding a SnapshotGuard */
+  mutable std::atomic<bool> has_retired_snapshots_;
+  mutable std::vector<std::unique_ptr<const BotSnapshot>> retired_snapshots_;
+  mutable std::mutex snapshot_update_mutex_; /** Serializes writers and the reclaim of retired snapshots */
+
+  ros::WallTimer parameter_watch_timer_;
+
+  Eigen::Isometry3d dh_base_offset_; /** DH base link in the base frame, fixed for the robot model */
+  Eigen::Isometry3d dh_tool_offset_; /** Tip frame in the DH tip link, fixed for the robot model */
+
+  std::unique_ptr<shm::ShmIKClient> shm_client_; /** Set if queries are forwarded to a shared memory IK server */
+
+  // searchRegionIK samples from one generator per plugin, seeding a new one costs more than a short search
+  mutable random_numbers::RandomNumberGenerator region_rng_;
+  mutable std::mutex region_rng_mutex_;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 };
 }  // namespace moveit_bot_kinematics_plugin
 
@@ -0,0 +1,245 @@
+#ifndef MOVEIT_BOT_KINEMATICS_PLUGIN_SHM_IK_CHANNEL_
+#define MOVEIT_BOT_KINEMATICS_PLUGIN_SHM_IK_CHANNEL_
+
+// System
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Eigen
+#include <Eigen/Geometry>
+
+// Bot kinematics
+#include "bot_kinematics/bot_kinematics.h"
+
+namespace moveit_bot_kinematics_plugin
+{
+namespace shm
+{
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared memory channel needs lock-free 32 bit atomics");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory channel needs lock-free 64 bit atomics");
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "idle workers wait on a futex");
+
+const std::uint32_t magic = 0x424f5449;  // "BOTI"
+const std::uint32_t version = 6;
+
+// the server refreshes the heartbeat at least this often, clients treat a segment as dead after heartbeat_timeout.
+// clients also never wait longer than heartbeat_timeout for an answer, older requests are reclaimed by the server
+const std::uint64_t heartbeat_period_ns = 100000000;
+const std::uint64_t heartbeat_timeout_ns = 1000000000;
+
+const std::size_t num_slots = 64;
+const std::size_t max_solutions = bot_kinematics::max_solutions;
+
+/**
+ * @brief Life cycle of a slot. A client claims a FREE slot, fills in the request and publishes it as REQUEST.
+ * A server worker takes it (SERVING), writes the answer and publishes DONE, after which the client reads it
+ * and hands the slot back (FREE). A client that times out while its request is being served marks the slot
+ * ABANDONED and the worker frees it instead of publishing the answer. The server frees CLAIMED, REQUEST and
+ * DONE slots whose client died or which are older than heartbeat_timeout_ns (see Slot::owner).
+ */
+enum SlotState : std::uint32_t
+{
+  FREE = 0,
+  CLAIMED,
+  REQUEST,
+  SERVING,
+  DONE,
+  ABANDONED
+};
+
+/**
+ * @brief Slot::state holds the state in its low bits and the ticket of the claim in the others. Every claim
+ * gets a new ticket, so a transition can never hit a later claim of the same slot after it was reclaimed.
+ */
+const int state_bits = 3;
+const std::uint64_t state_mask = (1u << state_bits) - 1;
+
+inline std::uint64_t slotWord(std::uint64_t ticket, SlotState state)
+{
+  return (ticket << state_bits) | state;
+}
+
+inline SlotState slotState(std::uint64_t word)
+{
+  return static_cast<SlotState>(word & state_mask);
+}
+
+inline std::uint64_t slotTicket(std::uint64_t word)
+{
+  return word >> state_bits;
+}
+
+/**
+ * @brief How the server answered a request
+ */
+enum SlotStatus : std::uint32_t
+{
+  SOLVED = 0,  // num_solutions solutions (maybe none) for the client's configuration
+  MISMATCH     // the server is configured differently from the client, e.g. during a parameter update
+};
+
+struct Slot
+{
+  std::atomic<std::uint64_t> state;  // see slotWord
+  // who claimed the slot and when (CLOCK_MONOTONIC ns), valid once stamp holds the ticket of the claim
+  std::atomic<std::int32_t> owner;
+  std::atomic<std::uint64_t> claimed;
+  std::atomic<std::uint64_t> stamp;
+  std::uint32_t status;
+  std::uint64_t fingerprint;  // configuration the client solves with, the server only answers if it has the same
+  std::uint32_t num_solutions;
+  double pose[bot_kinematics::frame_size];  // column-major 4x4 matrix
+  double solutions[max_solutions * bot_kinematics::number_of_joints];
+};
+
+/**
+ * @brief Layout of the shared memory segment. All fields besides the slot payloads and the heartbeat are only
+ * written by the server before magic is published. magic, version, server_alive and heartbeat keep their
+ * offsets in all versions, so a starting server can tell whether the segment it finds belongs to a live one.
+ */
+struct Segment
+{
+  std::atomic<std::uint32_t> magic;
+  std::uint32_t version;
+  std::uint32_t number_of_joints;
+  std::atomic<std::uint64_t> fingerprint;  // current configuration of the server's solver
+  std::atomic<std::uint32_t> server_alive;  // cleared when the server stops, stays set if it crashes
+  std::atomic<std::uint64_t> heartbeat;     // CLOCK_MONOTONIC time in ns of the last sign of life of the server
+  std::atomic<std::uint32_t> head;  // ring position where clients start looking for a free slot
+  std::atomic<std::uint64_t> tickets;       // source of the claim tickets
+  std::atomic<std::uint32_t> requests;      // bumped for every posted request, idle workers wait on it (futex)
+  std::atomic<std::uint32_t> idle_workers;  // workers that may be waiting on requests
+  Slot slots[num_slots];
+};
+
+/**
+ * @brief Convert a kinematics_solver_service_name into a POSIX shared memory object name
+ */
+std::string segmentName(const std::string& service_name);
+
+/**
+ * @brief Client side of the channel, used by the plugin to forward IK queries to a bot_ik_server.
+ * A server that stops, crashes or is not started yet is picked up again by later queries, so the client
+ * can be kept around for the lifetime of the plugin.
+ */
+class ShmIKClient
+{
+public:
+  ShmIKClient();
+  ~ShmIKClient();
+
+  /**
+   * @brief Remember the server to use and try to connect to it right away.
+   * @param fingerprint configuration of the client's solver, servers with another one are not used
+   * @return false if the server is not available yet or configured differently, solve() keeps retrying then.
+   */
+  bool connect(const std::string& service_name, std::uint64_t fingerprint);
+
+  /**
+   * @brief Unmap all segments, must not be called while queries are running
+   */
+  void disconnect();
+  bool connected() const;
+
+  /**
+   * @brief Send one IK request and wait for the answer. Thread safe.
+   * @param fingerprint configuration the caller would solve the request with, checked by the server per request
+   * so parameter updates on either side never mix configurations
+   * @return false if there is no live server, it is configured differently, there is no free slot or the
+   * timeout expired. The caller should then solve locally.
+   */
+  bool solve(const Eigen::Affine3d& pose, std::uint64_t fingerprint, std::vector<std::vector<double>>& solutions,
+             double timeout);
+
+private:
+  Segment* reconnect(Segment* stale, std::uint64_t fingerprint);
+
+  std::string service_name_;
+  std::atomic<Segment*> segment_;
+
+  // Queries may still use a segment when its server goes away, so stale mappings are only unmapped
+  // in disconnect(). Reconnects are rate limited, which also bounds how many of them pile up.
+  std::mutex connect_mutex_;
+  std::vector<Segment*> stale_segments_;
+  std::chrono::steady_clock::time_point next_connect_;
+};
+
+/**
+ * @brief Server side of the channel. Holds one worker pool and one solution cache for all clients.
+ * Idle workers sleep on a futex and only wake up for requests and the heartbeat.
+ * It can also be started inside a test process as a local stand-in for the bot_ik_server node.
+ */
+class ShmIKServer
+{
+public:
+  typedef std::function<bool(const Eigen::Affine3d&, std::vector<std::vector<double>>&)> SolveFn;
+  typedef std::function<std::uint64_t()> FingerprintFn;
+
+  /**
+   * @param fingerprint returns the current configuration of the solver (see
+   * MoveItBotKinematicsPlugin::getConfigurationFingerprint). Requests from clients configured differently
+   * are not solved, and cached solutions of another configuration are not used.
+   */
+  ShmIKServer(const std::string& service_name, const SolveFn& solve, unsigned int num_workers,
+              const FingerprintFn& fingerprint);
+  ~ShmIKServer();
+
+  bool start();
+  void stop();
+
+  /**
+   * @brief Drop all cached solutions, e.g. after the kinematic parameters changed
+   */
+  void clearCache();
+
+private:
+  struct CacheEntry
+  {
+    bool valid;
+    std::uint64_t fingerprint;
+    double pose[bot_kinematics::frame_size];
+    std::vector<std::vector<double>> solutions;
+  };
+
+  struct Sighting
+  {
+    std::uint64_t word;
+    std::uint64_t since;
+  };
+
+  void work(unsigned int worker_index);
+  void serve(Slot& slot, std::uint64_t ticket);
+  void reclaim(std::uint64_t now);
+  bool lookup(const double* pose, std::uint64_t fingerprint, std::vector<std::vector<double>>& solutions);
+  void store(const double* pose, std::uint64_t fingerprint, const std::vector<std::vector<double>>& solutions);
+
+  std::string name_;
+  SolveFn solve_;
+  FingerprintFn fingerprint_;
+  unsigned int num_workers_;
+
+  Segment* segment_;
+  std::size_t size_;
+
+  std::atomic<bool> running_;
+  std::vector<std::thread> workers_;
+
+  // only used by the first worker: when it first saw each slot in its current state, for claims whose client
+  // died before stamping them
+  std::uint64_t last_reclaim_;
+  std::vector<Sighting> sightings_;
+
+  std::mutex cache_mutex_;
+  std::vector<CacheEntry> cache_;
+};
+
+}  // namespace shm
+}  // namespace moveit_bot_kinematics_plugin
+
+#endif
@@ -0,0 +1,48 @@
+// Shared memory IK server: holds one kinematic model, one solution cache and one worker pool
+// for all planning nodes on this machine that use kinematics_solver_backend: shm
+
+#include <ros/ros.h>
+
+#include <moveit_bot_kinematics_plugin/moveit_bot_kinematics_plugin.h>
+#include <moveit_bot_kinematics_plugin/shm_ik_channel.h>
+
+#include <thread>
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "bot_ik_server");
+  ros::NodeHandle pnh("~");
+
+  std::string robot_description, group_name, base_frame, tip_frame, service_name;
+  int num_workers;
+  pnh.param<std::string>("robot_description", robot_description, "robot_description");
+  pnh.param<std::string>("service_name", service_name, "solve_ik");
+  pnh.param<int>("num_workers", num_workers, std::thread::hardware_concurrency());
+  if (!pnh.getParam("group", group_name) || !pnh.getParam("base_frame", base_frame) ||
+      !pnh.getParam("tip_frame", tip_frame))
+  {
+    ROS_ERROR_NAMED("bot", "Parameters ~group, ~base_frame and ~tip_frame are required");
+    return 1;
+  }
+
+  moveit_bot_kinematics_plugin::MoveItBotKinematicsPlugin kinematics;
+  if (!kinematics.initialize(robot_description, group_name, base_frame, tip_frame, 0.1))
+  {
+    ROS_ERROR_NAMED("bot", "Could not initialize kinematics for group '%s'", group_name.c_str());
+    return 1;
+  }
+
+  moveit_bot_kinematics_plugin::shm::ShmIKServer server(
+      service_name,
+      [&kinematics](const Eigen::Affine3d& pose, std::vector<std::vector<double>>& solutions) {
+        return kinematics.getLocalIK(pose, solutions);
+      },
+      num_workers, [&kinematics]() { return kinematics.getConfigurationFingerprint(); });
+  if (!server.start())
+    return 1;
+
+  ros::spin();
+
+  server.stop();
+  return 0;
+}
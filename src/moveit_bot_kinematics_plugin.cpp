@@ -8,6 +8,7 @@
 #include <moveit/kinematics_base/kinematics_base.h>
 #include <moveit/rdf_loader/rdf_loader.h>
 #include <moveit/robot_state/conversions.h>
+#include <random_numbers/random_numbers.h>
 
 // Eigen
 #include <Eigen/Core>
@@ -16,6 +17,7 @@
 
 // Bot kinematics
 #include "bot_kinematics/bot_kinematics.h"
+#include "bot_kinematics/bot_kinematics_io.h"
 #include "bot_kinematics/bot_kinematics_utils.h"
 
 // register BotKinematics as a KinematicsBase implementation
@@ -25,7 +27,12 @@ namespace moveit_bot_kinematics_plugin
 {
 using kinematics::KinematicsResult;
 
-MoveItBotKinematicsPlugin::MoveItBotKinematicsPlugin() : active_(false)
+MoveItBotKinematicsPlugin::MoveItBotKinematicsPlugin()
+  : active_(false)
+  , ik_mode_(bot_kinematics::Mode::full)
+  , snapshot_(nullptr)
+  , snapshot_readers_(0)
+  , has_retired_snapshots_(false)
 {
 }
 
@@ -86,13 +93,13 @@ bool MoveItBotKinematicsPlugin::initialize(const std::string& robot_description,
     std::copy(tip_frames_.begin(), tip_frames_.end(), std::ostream_iterator<std::string>(std::cout, "\n"));
   }
 
-  // Make sure all the tip links are in the link_names vector
+  // Make sure all the tip links are in the link_names vector.
+  // Tips outside the group are fine as long as they are rigidly attached to the end of the DH chain.
   for (std::size_t i = 0; i < tip_frames_.size(); ++i)
   {
-    if (!joint_model_group_->hasLinkModel(tip_frames_[i]))
+    if (!robot_model_->hasLinkModel(tip_frames_[i]))
     {
-      ROS_ERROR_NAMED("bot", "Could not find tip name '%s' in joint group '%s'", tip_frames_[i].c_str(),
-                      group_name.c_str());
+      ROS_ERROR_NAMED("bot", "Could not find tip name '%s' in robot model", tip_frames_[i].c_str());
       return false;
     }
     ik_group_info_.link_names.push_back(tip_frames_[i]);
@@ -104,10 +111,78 @@ bool MoveItBotKinematicsPlugin::initialize(const std::string& robot_description,
   std::string ik_service_name;
   lookupParam("kinematics_solver_service_name", ik_service_name, std::string("solve_ik"));
 
+  // Queries are solved in this process unless a shared memory IK server is requested
+  std::string backend;
+  lookupParam("kinematics_solver_backend", backend, std::string("local"));
+  if (backend != "local" && backend != "shm")
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "Unknown kinematics_solver_backend '" << backend << "', use 'local' or 'shm'");
+    return false;
+  }
+
   // Setup the joint state groups that we need
   robot_state_.reset(new robot_state::RobotState(robot_model_));
   robot_state_->setToDefaultValues();
 
+  // Solve the full pose, or only the position (and tool axis) for tasks that do not need the rest
+  std::string ik_mode;
+  lookupParam("kinematics_solver_ik_mode", ik_mode, std::string("full"));
+  if (ik_mode == "full")
+    ik_mode_ = bot_kinematics::Mode::full;
+  else if (ik_mode == "position")
+    ik_mode_ = bot_kinematics::Mode::position;
+  else if (ik_mode == "position_axis")
+    ik_mode_ = bot_kinematics::Mode::position_axis;
+  else
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "Unknown kinematics_solver_ik_mode '" << ik_mode
+                                                                        << "', use 'full', 'position' or "
+                                                                           "'position_axis'");
+    return false;
+  }
+
+  // Trig implementation used by the kernels, see bot_kinematics/bot_kinematics_math.h for the error bounds
+  std::string math_policy;
+  lookupParam("kinematics_solver_math_policy", math_policy, std::string("exact"));
+  math_policy_ = math_policy;
+  if (math_policy == "exact")
+    setMathPolicy<bot_kinematics::ExactMath>();
+  else if (math_policy == "sincos")
+    setMathPolicy<bot_kinematics::SincosMath>();
+  else if (math_policy == "fast")
+    setMathPolicy<bot_kinematics::FastMath>();
+  else
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "Unknown kinematics_solver_math_policy '" << math_policy
+                                                                            << "', use 'exact', 'sincos' or 'fast'");
+    return false;
+  }
+
+  // base_frame and the tip frame may differ from the ends of the DH chain by a fixed offset
+  // (calibrated base, mounted tool), the offsets are computed once here and folded into the kernels
+  std::string dh_base_link, dh_tip_link;
+  lookupParam("kinematics_solver_dh_base_link", dh_base_link, base_frame_);
+  lookupParam("kinematics_solver_dh_tip_link", dh_tip_link, tip_frames_[0]);
+  if (!getFixedTransform(base_frame_, dh_base_link, dh_base_offset_))
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "DH base link '" << dh_base_link << "' is not rigidly attached to base frame '"
+                                                   << base_frame_ << "'");
+    return false;
+  }
+  if (!getFixedTransform(dh_tip_link, tip_frames_[0], dh_tool_offset_))
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "Tip frame '" << tip_frames_[0] << "' is not rigidly attached to DH tip link '"
+                                                << dh_tip_link << "'");
+    return false;
+  }
+  if (ik_mode_ != bot_kinematics::Mode::full && !dh_tool_offset_.translation().isZero())
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "kinematics_solver_ik_mode '" << ik_mode << "' needs tip frame '" << tip_frames_[0]
+                                                                << "' at the origin of DH tip link '" << dh_tip_link
+                                                                << "'");
+    return false;
+  }
+
   // set dh parameters for bot model
   if (!setBotParameters())
   {
@@ -115,11 +190,39 @@ bool MoveItBotKinematicsPlugin::initialize(const std::string& robot_description,
     return false;
   }
 
+  // Optionally poll the parameter server so calibrated dh parameters apply without a restart
+  double watch_period;
+  lookupParam("kinematics_solver_dh_parameters_watch_period", watch_period, 0.0);
+  if (watch_period > 0.0)
+  {
+    ros::NodeHandle nh;
+    parameter_watch_timer_ =
+        nh.createWallTimer(ros::WallDuration(watch_period), &MoveItBotKinematicsPlugin::watchBotParameters, this);
+  }
+
+  // The server has to solve exactly like this plugin would, so the client connects once the configuration is
+  // complete. It keeps looking for the server, which may be started (or restarted) after move_group
+  shm_client_.reset();
+  if (backend == "shm")
+  {
+    shm_client_.reset(new shm::ShmIKClient());
+    if (!shm_client_->connect(ik_service_name, getConfigurationFingerprint()))
+      ROS_WARN_STREAM_NAMED("bot", "IK server '" << ik_service_name << "' not available yet, solving locally");
+  }
+
   active_ = true;
   ROS_DEBUG_NAMED("bot", "ROS service-based kinematics solver initialized");
   return true;
 }
 
+template <typename Math>
+void MoveItBotKinematicsPlugin::setMathPolicy()
+{
+  kernels_.inverse = &bot_kinematics::inverse<double, Math>;
+  kernels_.forward = &bot_kinematics::forward<double, Math>;
+  kernels_.forward_trajectory = &bot_kinematics::forwardTrajectory<double, Math>;
+}
+
 bool MoveItBotKinematicsPlugin::setRedundantJoints(const std::vector<unsigned int>& redundant_joints)
 {
   if (num_possible_redundant_joints_ < 0)
@@ -284,7 +387,7 @@ bool MoveItBotKinematicsPlugin::searchPositionIK(const std::vector<geometry_msgs
   Eigen::Affine3d pose;
   tf::poseMsgToEigen(ik_poses[0], pose);
   std::vector<std::vector<double>> solutions;
-  if (!getAllIK(pose, solutions))
+  if (!getAllIK(pose, ik_seed_state, timeout, solutions, options.return_approximate_solution))
   {
     ROS_INFO_STREAM_NAMED("bot", "Failed to find IK solution");
     error_code.val = error_code.NO_IK_SOLUTION;
@@ -344,7 +447,7 @@ bool MoveItBotKinematicsPlugin::getPositionIK(const std::vector<geometry_msgs::P
   }
   Eigen::Affine3d pose;
   tf::poseMsgToEigen(ik_poses[0], pose);
-  return getAllIK(pose, solutions);
+  return getAllIK(pose, ik_seed_state, default_timeout_, solutions, options.return_approximate_solution);
 }
 
 bool MoveItBotKinematicsPlugin::getPositionFK(const std::vector<std::string>& link_names,
@@ -374,7 +477,161 @@ bool MoveItBotKinematicsPlugin::getPositionFK(const std::vector<std::string>& li
 
   // forward function expect pointer to first element of array of joint values
   // that is why &joint_angles[0] is passed
-  tf::poseEigenToMsg(bot_kinematics::forward(bot_parameters_, &joint_angles[0]), poses[0]);
+  const SnapshotGuard guard(*this);
+  const BotSnapshot& bot = *guard;
+  tf::poseEigenToMsg(kernels_.forward(bot.parameters, bot.offsets, &joint_angles[0]), poses[0]);
+
+  return true;
+}
+
+bool MoveItBotKinematicsPlugin::getTrajectoryFK(const double* joint_trajectory, std::size_t num_waypoints,
+                                                double* frames, bool all_links) const
+{
+  if (!active_)
+  {
+    ROS_ERROR_NAMED("bot", "kinematics not active");
+    return false;
+  }
+
+  if (dimension_ != bot_kinematics::number_of_joints)
+  {
+    ROS_ERROR_NAMED("bot", "Trajectory FK expects %d joints per waypoint, group has %d",
+                    bot_kinematics::number_of_joints, dimension_);
+    return false;
+  }
+
+  if (num_waypoints > 0 && (!joint_trajectory || !frames))
+  {
+    ROS_ERROR_NAMED("bot", "Trajectory and frame buffers must not be null");
+    return false;
+  }
+
+  const SnapshotGuard guard(*this);
+  const BotSnapshot& bot = *guard;
+  kernels_.forward_trajectory(bot.parameters, bot.offsets, joint_trajectory, num_waypoints, frames, all_links);
+
+  return true;
+}
+
+std::size_t MoveItBotKinematicsPlugin::getTrajectoryFKBufferSize(std::size_t num_waypoints, bool all_links)
+{
+  return num_waypoints * (all_links ? bot_kinematics::number_of_frames : 1) * bot_kinematics::frame_size;
+}
+
+bool MoveItBotKinematicsPlugin::searchRegionIK(const geometry_msgs::Pose& center, const Eigen::Vector3d& half_extents,
+                                               double orientation_tolerance, std::size_t sample_budget,
+                                               std::size_t max_solutions, const std::vector<double>& ik_seed_state,
+                                               const std::vector<double>& consistency_limits,
+                                               std::vector<std::vector<double>>& solutions, bool seed_nearest) const
+{
+  solutions.clear();
+
+  if (!active_)
+  {
+    ROS_ERROR_NAMED("bot", "kinematics not active");
+    return false;
+  }
+
+  if (ik_seed_state.size() != dimension_ || dimension_ != bot_kinematics::number_of_joints)
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "Seed state must have size " << bot_kinematics::number_of_joints
+                                                               << " instead of size " << ik_seed_state.size());
+    return false;
+  }
+
+  if (!consistency_limits.empty() && consistency_limits.size() != dimension_)
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "Consistency limits must be empty or have size " << dimension_ << " instead of size "
+                                                                                 << consistency_limits.size());
+    return false;
+  }
+
+  if (max_solutions == 0)
+    return false;
+
+  // joint limits once per call instead of going through the robot state for every candidate
+  const int n = bot_kinematics::number_of_joints;
+  double lower[bot_kinematics::number_of_joints], upper[bot_kinematics::number_of_joints];
+  const std::vector<const robot_model::JointModel*>& joints = joint_model_group_->getActiveJointModels();
+  for (int j = 0; j < n; ++j)
+  {
+    const robot_model::VariableBounds& bounds = joints[j]->getVariableBounds()[0];
+    lower[j] = bounds.position_bounded_ ? bounds.min_position_ : -std::numeric_limits<double>::infinity();
+    upper[j] = bounds.position_bounded_ ? bounds.max_position_ : std::numeric_limits<double>::infinity();
+    if (!consistency_limits.empty())
+    {
+      lower[j] = std::max(lower[j], ik_seed_state[j] - consistency_limits[j]);
+      upper[j] = std::min(upper[j], ik_seed_state[j] + consistency_limits[j]);
+    }
+  }
+
+  Eigen::Affine3d center_pose;
+  tf::poseMsgToEigen(center, center_pose);
+
+  // the same snapshot for the whole region, samples are solved locally even with an IK server
+  const SnapshotGuard guard(*this);
+  const BotSnapshot& bot = *guard;
+  std::array<double, bot_kinematics::max_solutions * bot_kinematics::number_of_joints> sols;
+  std::vector<LimitObeyingSol> found;
+  const auto enough = [&]() { return !seed_nearest && found.size() >= max_solutions; };
+
+  for (std::size_t sampled = 0; sampled < sample_budget && !enough(); ++sampled)
+  {
+    // sample a pose in the region, only the draws are serialized between concurrent searches
+    Eigen::Vector3d offset, axis;
+    double angle;
+    {
+      std::lock_guard<std::mutex> lock(region_rng_mutex_);
+      offset << region_rng_.uniformReal(-half_extents.x(), half_extents.x()),
+          region_rng_.uniformReal(-half_extents.y(), half_extents.y()),
+          region_rng_.uniformReal(-half_extents.z(), half_extents.z());
+      axis << region_rng_.gaussian01(), region_rng_.gaussian01(), region_rng_.gaussian01();
+      angle = axis.norm() > 0.0 ? region_rng_.uniformReal(0.0, orientation_tolerance) : 0.0;
+    }
+
+    Eigen::Isometry3d sample;
+    sample = center_pose.matrix();
+    sample.translation() += center_pose.linear() * offset;
+    if (angle > 0.0)
+      sample.rotate(Eigen::AngleAxisd(angle, axis.normalized()));
+
+    const unsigned int mask = kernels_.inverse(bot.parameters, bot.offsets, sample, ik_mode_, sols.data(), false);
+    for (int branch = 0; branch < bot_kinematics::max_solutions && !enough(); ++branch)
+    {
+      if (!bot_kinematics::isValid(mask, branch))
+        continue;
+
+      double* sol = sols.data() + branch * n;
+      for (int j = 0; j < n; ++j)
+        if (!std::isfinite(sol[j]))
+          sol[j] = ik_seed_state[j];  // left free by the ik mode
+
+      // whole turns are picked near the seed before the limits are checked, so joints near +-pi and joints
+      // with limits wider than +-pi keep their solutions
+      if (!bot_kinematics::harmonizeToward(sol, ik_seed_state.data(), lower, upper))
+        continue;
+
+      std::vector<double> value(sol, sol + n);
+      const double dist = distance(value, ik_seed_state);
+      found.push_back({ std::move(value), dist });
+    }
+  }
+
+  if (found.empty())
+  {
+    ROS_DEBUG_NAMED("bot", "No valid solution in %zu region samples", sample_budget);
+    return false;
+  }
+
+  if (seed_nearest)
+  {
+    const std::size_t keep = std::min(max_solutions, found.size());
+    std::partial_sort(found.begin(), found.begin() + keep, found.end());
+    found.resize(keep);
+  }
+
+  for (auto& sol : found)
+    solutions.push_back(std::move(sol.value));
 
   return true;
 }
@@ -398,12 +655,20 @@ bool MoveItBotKinematicsPlugin::setBotParameters()
 {
   ROS_INFO_STREAM("Getting kinematic parameters from parameter server.");
 
+  bot_kinematics::Parameters<double> parameters;
+  if (!loadBotParameters(parameters))
+    return false;
+
+  return updateBotParameters(parameters);
+}
+
+bool MoveItBotKinematicsPlugin::loadBotParameters(bot_kinematics::Parameters<double>& parameters)
+{
   // Using the full parameter name at the moment because the leading slash
   // in front of robot_description_kinematics is missing
   // in lookupParam function, but I'm not sure if this is a bug or I do not
   // understand the interface.
   std::string prefix = "/robot_description_kinematics/" + group_name_ + "/";
-  ros::NodeHandle nh;
 
   std::map<std::string, double> dh_parameters, dummy;
   if (!lookupParam(prefix + "kinematics_solver_dh_parameters", dh_parameters, dummy))
@@ -412,17 +677,163 @@ bool MoveItBotKinematicsPlugin::setBotParameters()
     return false;
   }
 
-  bot_parameters_.a1 = dh_parameters["a1"];
-  bot_parameters_.a2 = dh_parameters["a2"];
-  bot_parameters_.a3 = dh_parameters["a3"];
-  bot_parameters_.l1 = dh_parameters["l1"];
-  bot_parameters_.l2 = dh_parameters["l2"];
-  bot_parameters_.l3 = dh_parameters["l3"];
-  bot_parameters_.t1 = dh_parameters["t1"];
-  bot_parameters_.t3 = dh_parameters["t3"];
+  parameters.a1 = dh_parameters["a1"];
+  parameters.a2 = dh_parameters["a2"];
+  parameters.a3 = dh_parameters["a3"];
+  parameters.l1 = dh_parameters["l1"];
+  parameters.l2 = dh_parameters["l2"];
+  parameters.l3 = dh_parameters["l3"];
+  parameters.t1 = dh_parameters["t1"];
+  parameters.t3 = dh_parameters["t3"];
+
+  return true;
+}
+
+bool MoveItBotKinematicsPlugin::reloadBotParameters()
+{
+  bot_kinematics::Parameters<double> parameters;
+  if (!loadBotParameters(parameters))
+    return false;
+
+  return updateBotParameters(parameters);
+}
+
+bool MoveItBotKinematicsPlugin::updateBotParameters(const bot_kinematics::Parameters<double>& parameters)
+{
+  if (!bot_kinematics::isValid(parameters))
+  {
+    ROS_ERROR_STREAM_NAMED("bot", "Rejected invalid parameters for ik solver:\n" << parameters);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(snapshot_update_mutex_);
+
+  std::unique_ptr<BotSnapshot> next(new BotSnapshot());
+  next->parameters = parameters;
+  next->offsets = bot_kinematics::makeOffsets(parameters, dh_base_offset_, dh_tool_offset_);
+  next->fingerprint = computeFingerprint(parameters);
+
+  // publish the complete snapshot in one store, queries pick it up on their next call
+  snapshot_.store(next.get());
+  if (current_snapshot_)
+  {
+    retired_snapshots_.push_back(std::move(current_snapshot_));
+    has_retired_snapshots_.store(true);
+  }
+  current_snapshot_ = std::move(next);
+  if (snapshot_readers_.load() == 0)
+  {
+    retired_snapshots_.clear();
+    has_retired_snapshots_.store(false);
+  }
+
+  ROS_INFO_STREAM("Loaded parameters for ik solver:\n" << parameters);
+
+  return true;
+}
+
+void MoveItBotKinematicsPlugin::reclaimSnapshots() const
+{
+  // a writer holding the lock reclaims on its own
+  std::unique_lock<std::mutex> lock(snapshot_update_mutex_, std::try_to_lock);
+  if (!lock.owns_lock())
+    return;
+
+  // queries that start from now on load the current snapshot, which is never retired while the lock is held
+  if (snapshot_readers_.load() == 0)
+  {
+    retired_snapshots_.clear();
+    has_retired_snapshots_.store(false);
+  }
+}
+
+// FNV-1a over raw bytes, values are compared bitwise like the server's solution cache does
+static void hashBytes(std::uint64_t& hash, const void* data, std::size_t size)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (std::size_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+}
+
+std::uint64_t MoveItBotKinematicsPlugin::getConfigurationFingerprint() const
+{
+  if (!snapshot_.load())
+    return 0;
+  const SnapshotGuard guard(*this);
+  return guard->fingerprint;
+}
+
+std::uint64_t MoveItBotKinematicsPlugin::computeFingerprint(const bot_kinematics::Parameters<double>& parameters) const
+{
+  std::uint64_t hash = 14695981039346656037ULL;
+
+  const int number_of_joints = bot_kinematics::number_of_joints;
+  const int ik_mode = static_cast<int>(ik_mode_);
+  hashBytes(hash, &number_of_joints, sizeof(number_of_joints));
+  hashBytes(hash, &ik_mode, sizeof(ik_mode));
+  hashBytes(hash, math_policy_.data(), math_policy_.size());
+  hashBytes(hash, dh_base_offset_.matrix().data(), bot_kinematics::frame_size * sizeof(double));
+  hashBytes(hash, dh_tool_offset_.matrix().data(), bot_kinematics::frame_size * sizeof(double));
 
-  ROS_INFO_STREAM("Loaded parameters for ik solver:\n" << bot_parameters_);
+  const double values[] = { parameters.a1, parameters.a2, parameters.a3, parameters.l1,
+                            parameters.l2, parameters.l3, parameters.t1, parameters.t3 };
+  hashBytes(hash, values, sizeof(values));
 
+  return hash;
+}
+
+void MoveItBotKinematicsPlugin::watchBotParameters(const ros::WallTimerEvent& /*event*/)
+{
+  bot_kinematics::Parameters<double> parameters;
+  if (!loadBotParameters(parameters))
+    return;
+
+  const SnapshotGuard guard(*this);
+  const bot_kinematics::Parameters<double>& current = guard->parameters;
+  if (parameters.a1 == current.a1 && parameters.a2 == current.a2 && parameters.a3 == current.a3 &&
+      parameters.l1 == current.l1 && parameters.l2 == current.l2 && parameters.l3 == current.l3 &&
+      parameters.t1 == current.t1 && parameters.t3 == current.t3)
+    return;
+
+  updateBotParameters(parameters);
+}
+
+// true if 'descendant' hangs below 'ancestor' through fixed joints only
+static bool isFixedBelow(const robot_model::LinkModel* ancestor, const robot_model::LinkModel* descendant)
+{
+  const robot_model::LinkModel* link = descendant;
+  while (link)
+  {
+    if (link == ancestor)
+      return true;
+    const robot_model::JointModel* joint = link->getParentJointModel();
+    if (!joint || joint->getType() != robot_model::JointModel::FIXED)
+      return false;
+    link = joint->getParentLinkModel();
+  }
+  return false;
+}
+
+bool MoveItBotKinematicsPlugin::getFixedTransform(const std::string& from, const std::string& to,
+                                                  Eigen::Isometry3d& transform) const
+{
+  const robot_model::LinkModel* from_link = robot_model_->getLinkModel(from);
+  const robot_model::LinkModel* to_link = robot_model_->getLinkModel(to);
+  if (!from_link || !to_link)
+    return false;
+
+  if (!isFixedBelow(from_link, to_link) && !isFixedBelow(to_link, from_link))
+    return false;
+
+  // only fixed joints in between, so the default state gives the same transform as any other
+  robot_state_->updateLinkTransforms();
+  Eigen::Isometry3d from_pose, to_pose;
+  from_pose = robot_state_->getGlobalLinkTransform(from_link).matrix();
+  to_pose = robot_state_->getGlobalLinkTransform(to_link).matrix();
+  transform = from_pose.inverse() * to_pose;
   return true;
 }
 
@@ -453,38 +864,52 @@ std::size_t MoveItBotKinematicsPlugin::closestJointPose(const std::vector<double
   return closest;
 }
 
-bool MoveItBotKinematicsPlugin::getAllIK(const Eigen::Affine3d& pose,
-                                         std::vector<std::vector<double>>& joint_poses) const
+bool MoveItBotKinematicsPlugin::getAllIK(const Eigen::Affine3d& pose, const std::vector<double>& seed_state,
+                                         double timeout, std::vector<std::vector<double>>& joint_poses,
+                                         bool approximate) const
 {
-  joint_poses.clear();
+  // fall back to solving locally if the IK server is gone or too slow.
+  // approximate solutions are only computed when there is no exact one, so they are always solved locally
+  if (!shm_client_ || !shm_client_->solve(pose, getConfigurationFingerprint(), joint_poses, timeout))
+    getLocalIK(pose, joint_poses);
+  if (joint_poses.empty() && approximate)
+    getLocalIK(pose, joint_poses, true);
+
+  // joints the ik mode leaves free keep their seed value
+  for (auto& joint_pose : joint_poses)
+    for (std::size_t i = 0; i < joint_pose.size() && i < seed_state.size(); ++i)
+      if (!std::isfinite(joint_pose[i]))
+        joint_pose[i] = seed_state[i];
 
-  // Transform input pose
-  // needed if we introduce a tip frame different from tool0
-  // or a different base frame
-  // Eigen::Affine3d tool_pose = diff_base.inverse() * pose *
-  // tip_frame.inverse();
+  return joint_poses.size() > 0;
+}
+
+bool MoveItBotKinematicsPlugin::getLocalIK(const Eigen::Affine3d& pose, std::vector<std::vector<double>>& joint_poses,
+                                           bool approximate) const
+{
+  joint_poses.clear();
 
   // convert Eigen::Affine3d to Eigen::Isometry3d for bot_kinematics
   Eigen::Isometry3d pose_isometry;
   pose_isometry = pose.matrix();
 
-  std::array<double, 3> sols;
-  bot_kinematics::inverse(bot_parameters_, pose_isometry, sols.data());
+  // all branches come back in one call, invalid ones are masked out.
+  // the base and tip frame offsets are applied by the kernel from the precomputed snapshot
+  const SnapshotGuard guard(*this);
+  const BotSnapshot& bot = *guard;
+  std::array<double, bot_kinematics::max_solutions * bot_kinematics::number_of_joints> sols;
+  const unsigned int mask =
+      kernels_.inverse(bot.parameters, bot.offsets, pose_isometry, ik_mode_, sols.data(), approximate);
 
-  // Check the output
-  std::vector<double> tmp(3);  // temporary storage for API reasons
-    double* sol = sols.data();
-    if (bot_kinematics::isValid(sol))
-    {
-      bot_kinematics::harmonizeTowardZero(sol);
-
-      // TODO: make this better...
-      std::copy(sol, sol + 3, tmp.data());
-      // if (isValid(tmp))
-      // {
-      joint_poses.push_back(tmp);
-      // }
-    }
+  for (int branch = 0; branch < bot_kinematics::max_solutions; ++branch)
+  {
+    if (!bot_kinematics::isValid(mask, branch))
+      continue;
+
+    double* sol = sols.data() + branch * bot_kinematics::number_of_joints;
+    bot_kinematics::harmonizeTowardZero(sol);
+    joint_poses.push_back(std::vector<double>(sol, sol + bot_kinematics::number_of_joints));
+  }
 
   return joint_poses.size() > 0;
 }
@@ -494,7 +919,7 @@ bool MoveItBotKinematicsPlugin::getIK(const Eigen::Affine3d& pose, const std::ve
 {
   // Descartes Robot Model interface calls for 'closest' point to seed position
   std::vector<std::vector<double>> joint_poses;
-  if (!getAllIK(pose, joint_poses))
+  if (!getAllIK(pose, seed_state, default_timeout_, joint_poses, false))
     return false;
   // Find closest joint pose; getAllIK() does isValid checks already
   joint_pose = joint_poses[closestJointPose(seed_state, joint_poses)];
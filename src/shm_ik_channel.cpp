@@ -0,0 +1,572 @@
+#include <moveit_bot_kinematics_plugin/shm_ik_channel.h>
+
+// System
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// ROS
+#include <ros/console.h>
+
+namespace moveit_bot_kinematics_plugin
+{
+namespace shm
+{
+namespace
+{
+const std::size_t cache_size = 1024;
+const std::chrono::seconds reconnect_period(1);
+
+// poses are compared bitwise, so the hash works on the raw bytes as well (FNV-1a)
+std::size_t hashPose(const double* pose)
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(pose);
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (std::size_t i = 0; i < bot_kinematics::frame_size * sizeof(double); ++i)
+  {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return static_cast<std::size_t>(hash);
+}
+
+void backoff(unsigned int& spins)
+{
+  if (++spins < 64)
+    return;
+  if (spins < 256)
+    std::this_thread::yield();
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+std::uint64_t monotonicNanoseconds()
+{
+  // CLOCK_MONOTONIC is system wide, so server and clients compare the same clock
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<std::uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<std::uint64_t>(now.tv_nsec);
+}
+
+bool isAlive(const Segment& segment)
+{
+  if (!segment.server_alive.load(std::memory_order_acquire))
+    return false;
+  const std::uint64_t heartbeat = segment.heartbeat.load(std::memory_order_relaxed);
+  const std::uint64_t now = monotonicNanoseconds();
+  return now < heartbeat || now - heartbeat < heartbeat_timeout_ns;
+}
+
+// the futexes live in the shared segment, so they must not use the process private variants
+void futexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::uint64_t timeout_ns)
+{
+  timespec timeout;
+  timeout.tv_sec = static_cast<time_t>(timeout_ns / 1000000000ULL);
+  timeout.tv_nsec = static_cast<long>(timeout_ns % 1000000000ULL);
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+void futexWake(std::atomic<std::uint32_t>& word, unsigned int count)
+{
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+// true for the segment of a server that died, false for a running server or one that is still starting
+bool isStale(int fd)
+{
+  // the liveness fields are at the same offsets in all versions (see Segment), only they are looked at
+  const std::size_t size = offsetof(Segment, heartbeat) + sizeof(Segment::heartbeat);
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(size))
+    return false;
+
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+    return false;
+  const Segment* segment = static_cast<const Segment*>(addr);
+  const bool stale = segment->magic.load(std::memory_order_acquire) == magic && !isAlive(*segment);
+  munmap(addr, size);
+  return stale;
+}
+
+// map the segment of a running server, nullptr if there is none or it is not compatible with this plugin
+Segment* mapSegment(const std::string& name, std::uint64_t fingerprint)
+{
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    return nullptr;
+
+  void* addr = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return nullptr;
+
+  Segment* segment = static_cast<Segment*>(addr);
+  if (segment->magic.load(std::memory_order_acquire) != magic || segment->version != version ||
+      segment->number_of_joints != static_cast<std::uint32_t>(bot_kinematics::number_of_joints))
+  {
+    ROS_WARN_NAMED("bot", "IK server segment '%s' is not compatible with this plugin", name.c_str());
+    munmap(addr, sizeof(Segment));
+    return nullptr;
+  }
+  if (segment->fingerprint.load(std::memory_order_relaxed) != fingerprint)
+  {
+    // a server with other dh parameters, frames, ik mode or math policy would return other solutions
+    ROS_WARN_THROTTLE_NAMED(10, "bot", "IK server at segment '%s' is configured differently from this plugin",
+                            name.c_str());
+    munmap(addr, sizeof(Segment));
+    return nullptr;
+  }
+  if (!isAlive(*segment))
+  {
+    munmap(addr, sizeof(Segment));
+    return nullptr;
+  }
+  return segment;
+}
+}  // namespace
+
+std::string segmentName(const std::string& service_name)
+{
+  std::string name = "/bot_ik_" + service_name;
+  for (std::size_t i = 1; i < name.size(); ++i)
+    if (name[i] == '/')
+      name[i] = '_';
+  return name;
+}
+
+ShmIKClient::ShmIKClient() : segment_(nullptr)
+{
+}
+
+ShmIKClient::~ShmIKClient()
+{
+  disconnect();
+}
+
+bool ShmIKClient::connect(const std::string& service_name, std::uint64_t fingerprint)
+{
+  disconnect();
+  service_name_ = service_name;
+
+  const std::string name = segmentName(service_name_);
+  Segment* segment = mapSegment(name, fingerprint);
+  if (!segment)
+  {
+    ROS_WARN_NAMED("bot", "No live IK server found at segment '%s'", name.c_str());
+    next_connect_ = std::chrono::steady_clock::now() + reconnect_period;
+    return false;
+  }
+
+  segment_.store(segment, std::memory_order_release);
+  ROS_INFO_NAMED("bot", "Connected to IK server segment '%s'", name.c_str());
+  return true;
+}
+
+void ShmIKClient::disconnect()
+{
+  std::lock_guard<std::mutex> lock(connect_mutex_);
+  Segment* segment = segment_.exchange(nullptr);
+  if (segment)
+    munmap(segment, sizeof(Segment));
+  for (std::size_t i = 0; i < stale_segments_.size(); ++i)
+    munmap(stale_segments_[i], sizeof(Segment));
+  stale_segments_.clear();
+}
+
+bool ShmIKClient::connected() const
+{
+  const Segment* segment = segment_.load(std::memory_order_acquire);
+  return segment && isAlive(*segment);
+}
+
+Segment* ShmIKClient::reconnect(Segment* stale, std::uint64_t fingerprint)
+{
+  // one thread reconnects, the others solve locally in the meantime
+  std::unique_lock<std::mutex> lock(connect_mutex_, std::try_to_lock);
+  if (!lock.owns_lock())
+    return nullptr;
+
+  Segment* current = segment_.load(std::memory_order_acquire);
+  if (current != stale)
+    return current;  // someone else was faster
+  if (service_name_.empty() || std::chrono::steady_clock::now() < next_connect_)
+    return nullptr;
+  next_connect_ = std::chrono::steady_clock::now() + reconnect_period;
+
+  const std::string name = segmentName(service_name_);
+  Segment* segment = mapSegment(name, fingerprint);
+  if (segment == nullptr && stale == nullptr)
+    return nullptr;
+  if (stale)
+  {
+    ROS_WARN_NAMED("bot", "IK server at segment '%s' stopped answering, solving locally", name.c_str());
+    stale_segments_.push_back(stale);
+  }
+  segment_.store(segment, std::memory_order_release);
+  if (segment)
+    ROS_INFO_NAMED("bot", "Connected to IK server segment '%s'", name.c_str());
+  return segment;
+}
+
+bool ShmIKClient::solve(const Eigen::Affine3d& pose, std::uint64_t fingerprint,
+                        std::vector<std::vector<double>>& solutions, double timeout)
+{
+  Segment* segment = segment_.load(std::memory_order_acquire);
+  if (!segment || !isAlive(*segment))
+    segment = reconnect(segment, fingerprint);
+  if (!segment)
+    return false;
+
+  // no round trip while either side is (still) on other parameters, the server checks again per request
+  if (segment->fingerprint.load(std::memory_order_relaxed) != fingerprint)
+    return false;
+
+  // claim a free slot, starting at the current ring position
+  Slot* slot = nullptr;
+  const std::uint64_t ticket = segment->tickets.fetch_add(1, std::memory_order_relaxed);
+  std::uint32_t start = segment->head.fetch_add(1, std::memory_order_relaxed);
+  for (std::size_t i = 0; i < num_slots && !slot; ++i)
+  {
+    Slot& candidate = segment->slots[(start + i) % num_slots];
+    std::uint64_t expected = candidate.state.load(std::memory_order_relaxed);
+    if (slotState(expected) == FREE &&
+        candidate.state.compare_exchange_strong(expected, slotWord(ticket, CLAIMED), std::memory_order_acquire))
+      slot = &candidate;
+  }
+  if (!slot)
+  {
+    ROS_DEBUG_NAMED("bot", "IK server has no free slot");
+    return false;
+  }
+
+  // lets the server free the slot should this process die before handing it back
+  const std::uint64_t claimed = monotonicNanoseconds();
+  slot->owner.store(static_cast<std::int32_t>(getpid()), std::memory_order_relaxed);
+  slot->claimed.store(claimed, std::memory_order_relaxed);
+  slot->stamp.store(ticket, std::memory_order_release);
+
+  Eigen::Map<Eigen::Matrix4d>(slot->pose) = pose.matrix();
+  slot->fingerprint = fingerprint;
+  slot->num_solutions = 0;
+  std::uint64_t expected = slotWord(ticket, CLAIMED);
+  if (!slot->state.compare_exchange_strong(expected, slotWord(ticket, REQUEST), std::memory_order_release))
+    return false;  // reclaimed by the server in the meantime
+
+  // only pay for the wake up syscall if a worker is (about to go) asleep, see ShmIKServer::work
+  segment->requests.fetch_add(1);
+  if (segment->idle_workers.load() > 0)
+    futexWake(segment->requests, 1);
+
+  // the server reclaims requests older than heartbeat_timeout, so never wait longer than that
+  const std::uint64_t wait_ns = static_cast<std::uint64_t>(
+      std::min(std::max(timeout, 0.0) * 1e9, static_cast<double>(heartbeat_timeout_ns - heartbeat_period_ns)));
+  unsigned int spins = 0;
+  std::uint64_t word;
+  while (slotState(word = slot->state.load(std::memory_order_acquire)) != DONE)
+  {
+    if (slotTicket(word) != ticket)
+      return false;  // reclaimed by the server
+    if (monotonicNanoseconds() - claimed < wait_ns && isAlive(*segment))
+    {
+      backoff(spins);
+      continue;
+    }
+
+    // give the slot back, or leave it to the worker that is currently serving it.
+    // both exchanges acquire on failure too: if they fail the state may be DONE and the payload is read below
+    expected = slotWord(ticket, REQUEST);
+    if (slot->state.compare_exchange_strong(expected, slotWord(ticket, FREE), std::memory_order_acquire))
+      return false;
+    expected = slotWord(ticket, SERVING);
+    if (slot->state.compare_exchange_strong(expected, slotWord(ticket, ABANDONED), std::memory_order_acquire))
+      return false;
+    // the answer arrived in the meantime, or the slot was reclaimed
+    word = expected;
+    break;
+  }
+  if (word != slotWord(ticket, DONE))
+    return false;
+
+  const bool solved = slot->status == SOLVED;
+  solutions.clear();
+  for (std::uint32_t i = 0; solved && i < slot->num_solutions; ++i)
+  {
+    const double* sol = slot->solutions + i * bot_kinematics::number_of_joints;
+    solutions.push_back(std::vector<double>(sol, sol + bot_kinematics::number_of_joints));
+  }
+
+  // if the server reclaimed the slot while it was read, the answer may be torn
+  expected = word;
+  if (!slot->state.compare_exchange_strong(expected, slotWord(ticket, FREE), std::memory_order_release))
+  {
+    solutions.clear();
+    return false;
+  }
+  return solved;
+}
+
+ShmIKServer::ShmIKServer(const std::string& service_name, const SolveFn& solve, unsigned int num_workers,
+                         const FingerprintFn& fingerprint)
+  : name_(segmentName(service_name))
+  , solve_(solve)
+  , fingerprint_(fingerprint)
+  , num_workers_(num_workers > 0 ? num_workers : 1)
+  , segment_(nullptr)
+  , size_(0)
+  , running_(false)
+  , last_reclaim_(0)
+  , sightings_(num_slots)
+  , cache_(cache_size)
+{
+  clearCache();
+}
+
+ShmIKServer::~ShmIKServer()
+{
+  stop();
+}
+
+bool ShmIKServer::start()
+{
+  if (running_)
+    return true;
+
+  // a previous server may have died without cleaning up, but a running one must not be cut off its clients
+  int fd = shm_open(name_.c_str(), O_RDWR, 0);
+  if (fd >= 0)
+  {
+    const bool stale = isStale(fd);
+    close(fd);
+    if (!stale)
+    {
+      ROS_ERROR_NAMED("bot", "IK server segment '%s' is in use by another server", name_.c_str());
+      return false;
+    }
+    ROS_WARN_NAMED("bot", "Replacing IK server segment '%s' of a server that stopped answering", name_.c_str());
+    shm_unlink(name_.c_str());
+  }
+  fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+  {
+    ROS_ERROR_NAMED("bot", "Could not create IK server segment '%s'", name_.c_str());
+    return false;
+  }
+  if (ftruncate(fd, sizeof(Segment)) != 0)
+  {
+    ROS_ERROR_NAMED("bot", "Could not size IK server segment '%s'", name_.c_str());
+    close(fd);
+    shm_unlink(name_.c_str());
+    return false;
+  }
+
+  void* addr = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+  {
+    ROS_ERROR_NAMED("bot", "Could not map IK server segment '%s'", name_.c_str());
+    shm_unlink(name_.c_str());
+    return false;
+  }
+
+  segment_ = new (addr) Segment;
+  size_ = sizeof(Segment);
+  segment_->version = version;
+  segment_->number_of_joints = bot_kinematics::number_of_joints;
+  segment_->fingerprint.store(fingerprint_(), std::memory_order_relaxed);
+  segment_->head.store(0, std::memory_order_relaxed);
+  segment_->tickets.store(1, std::memory_order_relaxed);
+  segment_->requests.store(0, std::memory_order_relaxed);
+  segment_->idle_workers.store(0, std::memory_order_relaxed);
+  for (std::size_t i = 0; i < num_slots; ++i)
+  {
+    segment_->slots[i].state.store(slotWord(0, FREE), std::memory_order_relaxed);
+    segment_->slots[i].stamp.store(0, std::memory_order_relaxed);
+    sightings_[i].word = slotWord(0, FREE);
+  }
+  segment_->server_alive.store(1, std::memory_order_relaxed);
+  segment_->heartbeat.store(monotonicNanoseconds(), std::memory_order_relaxed);
+  segment_->magic.store(magic, std::memory_order_release);
+
+  running_ = true;
+  for (unsigned int i = 0; i < num_workers_; ++i)
+    workers_.push_back(std::thread(&ShmIKServer::work, this, i));
+
+  ROS_INFO_NAMED("bot", "IK server serving segment '%s' with %u workers", name_.c_str(), num_workers_);
+  return true;
+}
+
+void ShmIKServer::stop()
+{
+  if (!segment_)
+    return;
+
+  segment_->server_alive.store(0, std::memory_order_release);
+  running_ = false;
+  segment_->requests.fetch_add(1);
+  futexWake(segment_->requests, num_workers_);
+  for (std::size_t i = 0; i < workers_.size(); ++i)
+    workers_[i].join();
+  workers_.clear();
+
+  segment_->magic.store(0, std::memory_order_release);
+  munmap(segment_, size_);
+  shm_unlink(name_.c_str());
+  segment_ = nullptr;
+  size_ = 0;
+}
+
+void ShmIKServer::clearCache()
+{
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  for (std::size_t i = 0; i < cache_.size(); ++i)
+    cache_[i].valid = false;
+}
+
+void ShmIKServer::work(unsigned int worker_index)
+{
+  // workers start at different slots so they do not all race for the same request
+  std::size_t index = worker_index * (num_slots / num_workers_);
+  while (running_)
+  {
+    // clients take a segment without a recent heartbeat for one of a crashed server
+    const std::uint64_t now = monotonicNanoseconds();
+    const std::uint64_t heartbeat = segment_->heartbeat.load(std::memory_order_relaxed);
+    if (now > heartbeat && now - heartbeat >= heartbeat_period_ns)
+      segment_->heartbeat.store(now, std::memory_order_relaxed);
+    if (worker_index == 0 && now - last_reclaim_ >= heartbeat_period_ns)
+      reclaim(now);
+    // follow parameter updates of the solver, so clients can tell without a round trip
+    segment_->fingerprint.store(fingerprint_(), std::memory_order_relaxed);
+
+    // count as idle before looking, so a client that posts its request after the look below wakes this
+    // worker (or the futex sees the changed counter and does not sleep at all)
+    segment_->idle_workers.fetch_add(1);
+    const std::uint32_t requests = segment_->requests.load();
+    Slot* slot = nullptr;
+    std::uint64_t ticket = 0;
+    for (std::size_t i = 0; i < num_slots && !slot; ++i, ++index)
+    {
+      Slot& candidate = segment_->slots[index % num_slots];
+      std::uint64_t expected = candidate.state.load(std::memory_order_relaxed);
+      if (slotState(expected) == REQUEST &&
+          candidate.state.compare_exchange_strong(expected, slotWord(slotTicket(expected), SERVING),
+                                                  std::memory_order_acquire))
+      {
+        slot = &candidate;
+        ticket = slotTicket(expected);
+      }
+    }
+    if (!slot)
+      futexWait(segment_->requests, requests, heartbeat_period_ns);
+    segment_->idle_workers.fetch_sub(1);
+
+    if (slot)
+      serve(*slot, ticket);
+  }
+}
+
+void ShmIKServer::reclaim(std::uint64_t now)
+{
+  last_reclaim_ = now;
+  for (std::size_t i = 0; i < num_slots; ++i)
+  {
+    Slot& slot = segment_->slots[i];
+    std::uint64_t word = slot.state.load(std::memory_order_acquire);
+    if (word != sightings_[i].word)
+      sightings_[i] = Sighting{ word, now };
+
+    // SERVING and ABANDONED slots belong to this server's workers
+    const SlotState state = slotState(word);
+    if (state != CLAIMED && state != REQUEST && state != DONE)
+      continue;
+
+    // a claim that is not stamped yet is aged by when it was first seen here. clients share the server's
+    // /dev/shm, they are expected to share its pid namespace as well
+    bool owner_gone = false;
+    std::uint64_t since = sightings_[i].since;
+    if (slot.stamp.load(std::memory_order_acquire) == slotTicket(word))
+    {
+      owner_gone = kill(slot.owner.load(std::memory_order_relaxed), 0) != 0 && errno == ESRCH;
+      since = slot.claimed.load(std::memory_order_relaxed);
+    }
+    if (!owner_gone && (now < since || now - since < heartbeat_timeout_ns))
+      continue;
+
+    // fails if the client moved on in the meantime, the ticket keeps later claims safe
+    if (slot.state.compare_exchange_strong(word, slotWord(slotTicket(word), FREE), std::memory_order_relaxed))
+      ROS_WARN_NAMED("bot", "IK server reclaimed slot %zu of a client that %s", i,
+                     owner_gone ? "died" : "did not hand it back");
+  }
+}
+
+void ShmIKServer::serve(Slot& slot, std::uint64_t ticket)
+{
+  // the configuration is read before and after solving: if it changed in between, the solutions may be for
+  // either one, so they are neither returned nor cached
+  std::vector<std::vector<double>> solutions;
+  bool solved = fingerprint_() == slot.fingerprint;
+  if (solved && !lookup(slot.pose, slot.fingerprint, solutions))
+  {
+    Eigen::Affine3d pose;
+    pose.matrix() = Eigen::Map<const Eigen::Matrix4d>(slot.pose);
+    if (!solve_(pose, solutions))
+      solutions.clear();
+    solved = fingerprint_() == slot.fingerprint;
+    if (solved)
+      store(slot.pose, slot.fingerprint, solutions);
+  }
+  slot.status = solved ? SOLVED : MISMATCH;
+  if (!solved)
+    solutions.clear();
+
+  std::uint32_t count = 0;
+  for (std::size_t i = 0; i < solutions.size() && count < max_solutions; ++i)
+  {
+    if (solutions[i].size() != static_cast<std::size_t>(bot_kinematics::number_of_joints))
+      continue;
+    std::copy(solutions[i].begin(), solutions[i].end(), slot.solutions + count * bot_kinematics::number_of_joints);
+    ++count;
+  }
+  slot.num_solutions = count;
+
+  std::uint64_t expected = slotWord(ticket, SERVING);
+  if (!slot.state.compare_exchange_strong(expected, slotWord(ticket, DONE), std::memory_order_release))
+    slot.state.store(slotWord(ticket, FREE), std::memory_order_release);  // client gave up on this request
+}
+
+bool ShmIKServer::lookup(const double* pose, std::uint64_t fingerprint, std::vector<std::vector<double>>& solutions)
+{
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  const CacheEntry& entry = cache_[hashPose(pose) % cache_.size()];
+  if (!entry.valid || entry.fingerprint != fingerprint || std::memcmp(entry.pose, pose, sizeof(entry.pose)) != 0)
+    return false;
+  solutions = entry.solutions;
+  return true;
+}
+
+void ShmIKServer::store(const double* pose, std::uint64_t fingerprint,
+                        const std::vector<std::vector<double>>& solutions)
+{
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  CacheEntry& entry = cache_[hashPose(pose) % cache_.size()];
+  entry.fingerprint = fingerprint;
+  std::memcpy(entry.pose, pose, sizeof(entry.pose));
+  entry.solutions = solutions;
+  entry.valid = true;
+}
+
+}  // namespace shm
+}  // namespace moveit_bot_kinematics_plugin
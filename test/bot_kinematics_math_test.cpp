@@ -0,0 +1,123 @@
+// Checks the error bounds documented in bot_kinematics_math.h, for the policies themselves and for the kernels
+// instantiated with them, against ExactMath over the full joint range.
+
+#include <gtest/gtest.h>
+
+#include "bot_kinematics/bot_kinematics.h"
+#include "bot_kinematics/bot_kinematics_math.h"
+#include "bot_kinematics/bot_kinematics_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace
+{
+using namespace bot_kinematics;
+
+const int num_samples = 100000;
+
+// documented bound of FastMath, and what it becomes on a pose of an arm of about two metres reach
+const double fast_tolerance = 3e-9;
+const double fast_pose_tolerance = 1e-8;
+
+const Parameters<double> parameters{ 0.1, 0.8, 0.7, 0.5, 0.1, 0.1, 0.01, 0.05 };
+
+template <typename Math>
+double maxSincosError(double range)
+{
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> angle(-range, range);
+  double error = 0;
+  for (int i = 0; i < num_samples; i++)
+  {
+    const double x = angle(rng);
+    double s, c;
+    Math::sincos(x, s, c);
+    error = std::max(error, std::max(std::abs(s - std::sin(x)), std::abs(c - std::cos(x))));
+  }
+  return error;
+}
+
+template <typename Math>
+double maxForwardError()
+{
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<double> angle(-2 * M_PI, 2 * M_PI);
+  double error = 0;
+  for (int i = 0; i < num_samples; i++)
+  {
+    double qs[number_of_joints];
+    for (int j = 0; j < number_of_joints; j++)
+      qs[j] = angle(rng);
+
+    const Transform<double> exact = forward<double, ExactMath>(parameters, qs);
+    const Transform<double> policy = forward<double, Math>(parameters, qs);
+    error = std::max(error, (exact.matrix() - policy.matrix()).cwiseAbs().maxCoeff());
+  }
+  return error;
+}
+
+// largest difference between the branches of ExactMath and of 'Math', the masks have to be the same
+template <typename Math>
+::testing::AssertionResult inverseMatches(double tolerance)
+{
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+  double error = 0;
+  for (int i = 0; i < num_samples; i++)
+  {
+    double qs[number_of_joints];
+    for (int j = 0; j < number_of_joints; j++)
+      qs[j] = angle(rng);
+    const Transform<double> pose = forward<double, ExactMath>(parameters, qs);
+
+    double exact[max_solutions * number_of_joints], policy[max_solutions * number_of_joints];
+    const unsigned int exact_mask = inverse<double, ExactMath>(parameters, pose, exact);
+    const unsigned int policy_mask = inverse<double, Math>(parameters, pose, policy);
+    if (exact_mask != policy_mask)
+      return ::testing::AssertionFailure() << "masks " << exact_mask << " and " << policy_mask << " differ";
+
+    for (int branch = 0; branch < max_solutions; branch++)
+      if (isValid(exact_mask, branch))
+        for (int j = 0; j < number_of_joints; j++)
+        {
+          const int k = branch * number_of_joints + j;
+          error = std::max(error, std::abs(std::remainder(exact[k] - policy[k], 2 * M_PI)));
+        }
+  }
+
+  if (error > tolerance)
+    return ::testing::AssertionFailure() << "branches differ by " << error;
+  return ::testing::AssertionSuccess();
+}
+
+TEST(MathPolicy, sincosMatchesLibm)
+{
+  EXPECT_LE(maxSincosError<SincosMath>(1000.0), 1e-15);
+}
+
+TEST(MathPolicy, fastWithinDocumentedBound)
+{
+  EXPECT_LE(maxSincosError<FastMath>(2 * M_PI), fast_tolerance);
+  EXPECT_LE(maxSincosError<FastMath>(1000.0), fast_tolerance);
+}
+
+TEST(MathPolicy, forwardKernels)
+{
+  EXPECT_LE(maxForwardError<SincosMath>(), 1e-15);
+  EXPECT_LE(maxForwardError<FastMath>(), fast_pose_tolerance);
+}
+
+TEST(MathPolicy, inverseKernels)
+{
+  EXPECT_TRUE(inverseMatches<SincosMath>(1e-15));
+  EXPECT_TRUE(inverseMatches<FastMath>(fast_pose_tolerance));
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
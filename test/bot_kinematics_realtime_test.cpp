@@ -0,0 +1,237 @@
+// Checks the promise at the top of bot_kinematics.h: the kernels neither allocate nor enter the kernel.
+// Every check runs in a forked child that counts allocations and is killed by seccomp on any system call.
+// This test replaces malloc and operator new for the whole executable, so it has to stay in its own target.
+
+#include <gtest/gtest.h>
+
+#include "bot_kinematics/bot_kinematics.h"
+#include "bot_kinematics/bot_kinematics_utils.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern "C" void* __libc_malloc(std::size_t size);
+extern "C" void* __libc_calloc(std::size_t count, std::size_t size);
+extern "C" void* __libc_realloc(void* ptr, std::size_t size);
+extern "C" void* __libc_memalign(std::size_t alignment, std::size_t size);
+
+namespace
+{
+// only allocations made while 'trapped' is set are counted, gtest itself allocates freely
+volatile bool trapped = false;
+volatile int allocations = 0;
+
+void countAllocation()
+{
+  if (trapped)
+    allocations = allocations + 1;
+}
+}  // namespace
+
+extern "C" void* malloc(std::size_t size)
+{
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+extern "C" void* calloc(std::size_t count, std::size_t size)
+{
+  countAllocation();
+  return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, std::size_t size)
+{
+  countAllocation();
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void* memalign(std::size_t alignment, std::size_t size)
+{
+  countAllocation();
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** ptr, std::size_t alignment, std::size_t size)
+{
+  countAllocation();
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr ? 0 : ENOMEM;
+}
+
+void* operator new(std::size_t size)
+{
+  countAllocation();
+  void* ptr = __libc_malloc(size);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return operator new(size, std::nothrow);
+}
+
+namespace
+{
+const int exit_clean = 0;
+const int exit_allocated = 2;
+const int exit_no_seccomp = 3;
+
+// kill the process on every system call but exit_group, which the child needs to report back
+bool trapSyscalls()
+{
+  sock_filter filter[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_exit_group, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL),
+  };
+  sock_fprog program = { static_cast<unsigned short>(sizeof(filter) / sizeof(filter[0])), filter };
+
+  return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 &&
+         prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &program, 0, 0) == 0;
+}
+
+/*
+ *Run 'body' in a child process with allocations counted and system calls trapped.
+ *Returns the wait status of the child.
+ */
+template <typename Body>
+int runTrapped(Body body)
+{
+  const pid_t pid = fork();
+  if (pid == 0)
+  {
+    if (!trapSyscalls())
+      _exit(exit_no_seccomp);
+    trapped = true;
+    body();
+    trapped = false;
+    _exit(allocations == 0 ? exit_clean : exit_allocated);
+  }
+
+  int status = -1;
+  waitpid(pid, &status, 0);
+  return status;
+}
+
+::testing::AssertionResult isClean(int status)
+{
+  if (WIFEXITED(status) && WEXITSTATUS(status) == exit_clean)
+    return ::testing::AssertionSuccess();
+  if (WIFEXITED(status) && WEXITSTATUS(status) == exit_allocated)
+    return ::testing::AssertionFailure() << "allocated memory";
+  if (WIFEXITED(status) && WEXITSTATUS(status) == exit_no_seccomp)
+    return ::testing::AssertionFailure() << "could not install the seccomp filter";
+  if (WIFSIGNALED(status) && WTERMSIG(status) == SIGSYS)
+    return ::testing::AssertionFailure() << "made a system call";
+  return ::testing::AssertionFailure() << "failed with wait status " << status;
+}
+
+// results go here so the compiler cannot drop the calls
+volatile double sink;
+double* volatile leaked;
+
+template <typename Math>
+void runKernels()
+{
+  using namespace bot_kinematics;
+
+  const Parameters<double> p{ 0.1, 0.8, 0.7, 0.5, 0.1, 0.1, 0.01, 0.02 };
+  Transform<double> base = Transform<double>::Identity();
+  base.translation() << 0.1, -0.2, 0.3;
+  Transform<double> tool = Transform<double>::Identity();
+  tool.linear() = Eigen::AngleAxisd(0.3, Eigen::Vector3d::UnitX()).toRotationMatrix();
+  const Offsets<double> plain = makeOffsets(p);
+  const Offsets<double> offset = makeOffsets(p, base, tool);
+
+  double out[max_solutions * number_of_joints];
+  Transform<double> frames[number_of_frames];
+  const Mode modes[] = { Mode::full, Mode::position, Mode::position_axis };
+
+  for (int i = 0; i < 100; i++)
+  {
+    double qs[number_of_joints];
+    for (int j = 0; j < number_of_joints; j++)
+      qs[j] = -3.0 + 0.06 * i + 0.5 * j;
+
+    const Transform<double> pose = forward<double, Math>(p, qs);
+    forwardChain<double, Math>(p, qs, frames);
+    forwardChain<double, Math>(p, offset, qs, frames);
+    const Transform<double> offset_pose = forward<double, Math>(p, offset, qs);
+
+    unsigned int mask = inverse<double, Math>(p, pose, out);
+    mask |= inverse<double, Math>(p, pose, out, true);
+    mask |= inverse<double, Math>(p, plain, pose, out);
+    for (Mode mode : modes)
+      mask |= inverse<double, Math>(p, offset, offset_pose, mode, out, true);
+
+    bool valid = isValid(p) && isValid(qs);
+    const double lower[] = { -2.0, -4.0, -6.0 }, upper[] = { 2.0, 4.0, 6.0 };
+    for (int branch = 0; branch < max_solutions; branch++)
+      if (isValid(mask, branch))
+      {
+        valid = valid && isValid(out + branch * number_of_joints);
+        harmonizeTowardZero(out + branch * number_of_joints);
+        valid = harmonizeToward(out + branch * number_of_joints, qs, lower, upper) && valid;
+      }
+
+    sink = pose(0, 3) + frames[number_of_frames - 1](1, 3) + out[0] + (valid ? 1.0 : 0.0);
+  }
+}
+
+TEST(RealtimeSafety, trapCatchesAllocations)
+{
+  EXPECT_FALSE(isClean(runTrapped([] { leaked = new double(1.0); })));
+}
+
+TEST(RealtimeSafety, trapCatchesSystemCalls)
+{
+  const int status = runTrapped([] { sink = syscall(SYS_getpid); });
+  EXPECT_TRUE(WIFSIGNALED(status) && WTERMSIG(status) == SIGSYS) << "wait status " << status;
+}
+
+TEST(RealtimeSafety, exactMathKernels)
+{
+  EXPECT_TRUE(isClean(runTrapped(runKernels<bot_kinematics::ExactMath>)));
+}
+
+TEST(RealtimeSafety, sincosMathKernels)
+{
+  EXPECT_TRUE(isClean(runTrapped(runKernels<bot_kinematics::SincosMath>)));
+}
+
+TEST(RealtimeSafety, fastMathKernels)
+{
+  EXPECT_TRUE(isClean(runTrapped(runKernels<bot_kinematics::FastMath>)));
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
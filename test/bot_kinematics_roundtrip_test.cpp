@@ -0,0 +1,233 @@
+// Checks that 'inverse' solves the chain of 'forwardChain': every branch in the mask must map back onto the pose
+// it was solved for, and one of them must be the joint angles the pose came from.
+
+#include <gtest/gtest.h>
+
+#include "bot_kinematics/bot_kinematics.h"
+#include "bot_kinematics/bot_kinematics_utils.h"
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+using namespace bot_kinematics;
+
+const int num_samples = 1000;
+const double position_tolerance = 1e-9;
+const double joint_tolerance = 1e-6;
+
+const Parameters<double> parameters{ 0.1, 0.8, 0.7, 0.5, 0.1, 0.1, 0.01, 0.05 };
+
+double angleDistance(double a, double b)
+{
+  return std::abs(std::remainder(a - b, 2 * M_PI));
+}
+
+// joint angles over the full turn of every joint
+void sampleJoints(std::mt19937& rng, double* qs)
+{
+  std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+  for (int j = 0; j < number_of_joints; j++)
+    qs[j] = angle(rng);
+}
+
+/*
+ *Solve 'pose' with 'o' and 'mode', then check every returned branch with 'forward'.
+ *Returns true if one branch is 'qs' (only the joints 'mode' solves).
+ */
+::testing::AssertionResult roundTrip(const Offsets<double>& o, const double* qs, Mode mode)
+{
+  const Transform<double> pose = forward(parameters, o, qs);
+
+  double out[max_solutions * number_of_joints];
+  const unsigned int mask = inverse(parameters, o, pose, mode, out);
+  if (mask == 0)
+    return ::testing::AssertionFailure() << "no solution";
+
+  bool found = false;
+  for (int branch = 0; branch < max_solutions; branch++)
+  {
+    if (!isValid(mask, branch))
+      continue;
+
+    double* sol = out + branch * number_of_joints;
+    const int solved_joints = mode == Mode::full ? number_of_joints : number_of_position_joints;
+    for (int j = solved_joints; j < number_of_joints; j++)
+      sol[j] = qs[j];  // free joints come back NaN
+    if (!isValid(sol))
+      return ::testing::AssertionFailure() << "branch " << branch << " is not finite";
+
+    // the example arm has no wrist, so branches only agree on the position of the DH tip
+    const Transform<double> check = forward(parameters, o, sol);
+    const double error = ((check * o.tool_inverse).translation() - (pose * o.tool_inverse).translation()).norm();
+    if (error > position_tolerance)
+      return ::testing::AssertionFailure() << "branch " << branch << " is " << error << " off";
+
+    bool same = true;
+    for (int j = 0; j < number_of_joints; j++)
+      same = same && angleDistance(sol[j], qs[j]) < joint_tolerance;
+    found = found || same;
+  }
+
+  if (!found)
+    return ::testing::AssertionFailure() << "no branch is the sampled configuration";
+  return ::testing::AssertionSuccess();
+}
+
+TEST(RoundTrip, allBranchesReachThePose)
+{
+  std::mt19937 rng(42);
+  const Offsets<double> o = makeOffsets(parameters);
+  for (int i = 0; i < num_samples; i++)
+  {
+    double qs[number_of_joints];
+    sampleJoints(rng, qs);
+    EXPECT_TRUE(roundTrip(o, qs, Mode::full)) << "q = " << qs[0] << " " << qs[1] << " " << qs[2];
+  }
+}
+
+TEST(RoundTrip, plainKernelsMatchIdentityOffsets)
+{
+  std::mt19937 rng(7);
+  const Offsets<double> o = makeOffsets(parameters);
+  for (int i = 0; i < num_samples; i++)
+  {
+    double qs[number_of_joints];
+    sampleJoints(rng, qs);
+    const Transform<double> plain = forward(parameters, qs);
+    EXPECT_TRUE(plain.isApprox(forward(parameters, o, qs), 1e-12));
+
+    double out[max_solutions * number_of_joints], out_offsets[max_solutions * number_of_joints];
+    EXPECT_EQ(inverse(parameters, plain, out), inverse(parameters, o, plain, out_offsets));
+  }
+}
+
+TEST(RoundTrip, baseAndToolOffsets)
+{
+  Transform<double> base = Transform<double>::Identity();
+  base.translation() << 0.2, -0.1, 0.3;
+  base.linear() = Eigen::AngleAxisd(0.4, Eigen::Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+  Transform<double> tool = Transform<double>::Identity();
+  tool.translation() << 0.0, 0.02, 0.1;
+  tool.linear() = Eigen::AngleAxisd(-0.7, Eigen::Vector3d::UnitY()).toRotationMatrix();
+  Transform<double> tool_rotation = tool;
+  tool_rotation.translation().setZero();
+
+  std::mt19937 rng(3);
+  const Offsets<double> o = makeOffsets(parameters, base, tool);
+  const Offsets<double> o_rotation = makeOffsets(parameters, base, tool_rotation);
+  for (int i = 0; i < num_samples; i++)
+  {
+    double qs[number_of_joints];
+    sampleJoints(rng, qs);
+    EXPECT_TRUE(roundTrip(o, qs, Mode::full));
+    // the reduced modes need the tool origin at the DH tip
+    EXPECT_TRUE(roundTrip(o_rotation, qs, Mode::position));
+    EXPECT_TRUE(roundTrip(o_rotation, qs, Mode::position_axis));
+  }
+}
+
+TEST(RoundTrip, harmonizeTowardSeed)
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  const double seed[] = { 3.1, 0.0, -3.0 };
+
+  // 3.2 rad comes back from the kernel as -3.08, it is 0.1 from the seed
+  double qs[] = { 3.2 - 2 * M_PI, 0.5, 3.0 };
+  const double lower[] = { 2.9, -inf, -inf };
+  const double upper[] = { 3.3, inf, inf };
+  ASSERT_TRUE(harmonizeToward(qs, seed, lower, upper));
+  EXPECT_NEAR(qs[0], 3.2, 1e-12);
+  EXPECT_NEAR(qs[1], 0.5, 1e-12);
+  EXPECT_NEAR(qs[2], 3.0 - 2 * M_PI, 1e-12);
+
+  // limits wider than +-pi: the value inside them nearest to the seed, not the one nearest to zero
+  double wide[] = { -3.0, 1.0, 0.5 };
+  const double wide_lower[] = { 0.0, -4 * M_PI, 2 * M_PI };
+  const double wide_upper[] = { 2 * M_PI, 4 * M_PI, 4 * M_PI };
+  ASSERT_TRUE(harmonizeToward(wide, seed, wide_lower, wide_upper));
+  EXPECT_NEAR(wide[0], 2 * M_PI - 3.0, 1e-12);
+  EXPECT_NEAR(wide[1], 1.0, 1e-12);
+  EXPECT_NEAR(wide[2], 0.5 + 2 * M_PI, 1e-12);
+
+  // no whole turn fits into the bounds
+  double out[] = { 1.0, 0.0, 0.0 };
+  const double narrow_lower[] = { 2.0, -inf, -inf };
+  const double narrow_upper[] = { 3.0, inf, inf };
+  EXPECT_FALSE(harmonizeToward(out, seed, narrow_lower, narrow_upper));
+
+  // branches moved toward a seed still reach the pose
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<double> angle(-4 * M_PI, 4 * M_PI);
+  const double none[] = { -inf, -inf, -inf };
+  const double all[] = { inf, inf, inf };
+  for (int i = 0; i < num_samples; i++)
+  {
+    double sample[number_of_joints], near[number_of_joints];
+    sampleJoints(rng, sample);
+    for (int j = 0; j < number_of_joints; j++)
+      near[j] = angle(rng);
+    const Transform<double> pose = forward(parameters, sample);
+
+    double sols[max_solutions * number_of_joints];
+    const unsigned int mask = inverse(parameters, pose, sols);
+    for (int branch = 0; branch < max_solutions; branch++)
+    {
+      if (!isValid(mask, branch))
+        continue;
+      double* sol = sols + branch * number_of_joints;
+      ASSERT_TRUE(harmonizeToward(sol, near, none, all));
+      for (int j = 0; j < number_of_joints; j++)
+        EXPECT_LE(std::abs(sol[j] - near[j]), M_PI + 1e-12);
+      EXPECT_LT((forward(parameters, sol).translation() - pose.translation()).norm(), position_tolerance);
+    }
+  }
+}
+
+// waypoints above parallel_waypoints so the OpenMP path (if built with it) is covered as well
+TEST(RoundTrip, trajectoryMatchesForwardChain)
+{
+  const std::size_t num_waypoints = parallel_waypoints + 3;
+  std::mt19937 rng(11);
+  std::vector<double> qs(num_waypoints * number_of_joints);
+  for (std::size_t i = 0; i < num_waypoints; i++)
+    sampleJoints(rng, &qs[i * number_of_joints]);
+
+  Transform<double> base = Transform<double>::Identity();
+  base.translation() << 0.2, -0.1, 0.3;
+  const Offsets<double> o = makeOffsets(parameters, base, Transform<double>::Identity());
+
+  std::vector<double> links(num_waypoints * number_of_frames * frame_size);
+  std::vector<double> tips(num_waypoints * frame_size);
+  std::vector<double> offset_tips(num_waypoints * frame_size);
+  forwardTrajectory(parameters, qs.data(), num_waypoints, links.data(), true);
+  forwardTrajectory(parameters, qs.data(), num_waypoints, tips.data(), false);
+  forwardTrajectory(parameters, o, qs.data(), num_waypoints, offset_tips.data(), false);
+
+  for (std::size_t i = 0; i < num_waypoints; i++)
+  {
+    Transform<double> frames[number_of_frames], offset_frames[number_of_frames];
+    forwardChain(parameters, &qs[i * number_of_joints], frames);
+    forwardChain(parameters, o, &qs[i * number_of_joints], offset_frames);
+
+    for (int j = 0; j < number_of_frames; j++)
+    {
+      const Eigen::Map<const Eigen::Matrix4d> link(&links[(i * number_of_frames + j) * frame_size]);
+      EXPECT_TRUE(link.isApprox(frames[j].matrix(), 1e-15)) << "waypoint " << i << " link " << j;
+    }
+    const Eigen::Map<const Eigen::Matrix4d> tip(&tips[i * frame_size]);
+    EXPECT_TRUE(tip.isApprox(frames[number_of_frames - 1].matrix(), 1e-15)) << "waypoint " << i;
+    const Eigen::Map<const Eigen::Matrix4d> offset_tip(&offset_tips[i * frame_size]);
+    EXPECT_TRUE(offset_tip.isApprox(offset_frames[number_of_frames - 1].matrix(), 1e-15)) << "waypoint " << i;
+  }
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,313 @@
+// Runs ShmIKServer inside the test process as a stand-in for the bot_ik_server node and talks to it through
+// ShmIKClient, the way the plugin does.
+
+#include <gtest/gtest.h>
+
+#include <moveit_bot_kinematics_plugin/shm_ik_channel.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+using namespace moveit_bot_kinematics_plugin::shm;
+
+const std::uint64_t fingerprint = 42;
+const double timeout = 0.5;
+
+// unique per test and process, so parallel test runs do not share segments
+std::string serviceName()
+{
+  return std::string("shm_ik_channel_test_") + ::testing::UnitTest::GetInstance()->current_test_info()->name() +
+         "_" + std::to_string(getpid());
+}
+
+// a solver that counts its calls, returns one solution made of the pose translation and can be slowed down
+struct FakeSolver
+{
+  std::atomic<int> calls;
+  std::atomic<int> delay_ms;
+  std::atomic<std::uint64_t> fingerprint;
+
+  FakeSolver() : calls(0), delay_ms(0), fingerprint(::fingerprint)
+  {
+  }
+
+  ShmIKServer::SolveFn solveFn()
+  {
+    return [this](const Eigen::Affine3d& pose, std::vector<std::vector<double>>& solutions) {
+      ++calls;
+      std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms.load()));
+      const Eigen::Vector3d p = pose.translation();
+      solutions.assign(1, std::vector<double>(p.data(), p.data() + bot_kinematics::number_of_joints));
+      return true;
+    };
+  }
+
+  ShmIKServer::FingerprintFn fingerprintFn()
+  {
+    return [this]() { return fingerprint.load(); };
+  }
+};
+
+Eigen::Affine3d poseAt(double x)
+{
+  Eigen::Affine3d pose = Eigen::Affine3d::Identity();
+  pose.translation() << x, 0.2, 0.3;
+  return pose;
+}
+
+bool waitFor(const std::function<bool()>& condition, double seconds)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+  while (!condition())
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return true;
+}
+
+// number of FREE slots in the segment of 'service_name', read straight from shared memory
+std::size_t freeSlots(const std::string& service_name)
+{
+  int fd = shm_open(segmentName(service_name).c_str(), O_RDWR, 0);
+  if (fd < 0)
+    return 0;
+  void* addr = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return 0;
+
+  const Segment* segment = static_cast<const Segment*>(addr);
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < num_slots; ++i)
+    if (slotState(segment->slots[i].state.load()) == FREE)
+      ++count;
+  munmap(addr, sizeof(Segment));
+  return count;
+}
+
+TEST(ShmIKChannel, roundTrip)
+{
+  FakeSolver solver;
+  ShmIKServer server(serviceName(), solver.solveFn(), 2, solver.fingerprintFn());
+  ASSERT_TRUE(server.start());
+
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(serviceName(), fingerprint));
+  EXPECT_TRUE(client.connected());
+
+  std::vector<std::vector<double>> solutions;
+  ASSERT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+  ASSERT_EQ(solutions.size(), 1u);
+  EXPECT_EQ(solutions[0], std::vector<double>({ 0.1, 0.2, 0.3 }));
+  EXPECT_EQ(freeSlots(serviceName()), num_slots);
+}
+
+TEST(ShmIKChannel, cacheHit)
+{
+  FakeSolver solver;
+  ShmIKServer server(serviceName(), solver.solveFn(), 2, solver.fingerprintFn());
+  ASSERT_TRUE(server.start());
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(serviceName(), fingerprint));
+
+  std::vector<std::vector<double>> solutions;
+  ASSERT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+  ASSERT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+  EXPECT_EQ(solver.calls, 1);
+  ASSERT_EQ(solutions.size(), 1u);
+  EXPECT_EQ(solutions[0], std::vector<double>({ 0.1, 0.2, 0.3 }));
+
+  server.clearCache();
+  ASSERT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+  EXPECT_EQ(solver.calls, 2);
+}
+
+TEST(ShmIKChannel, mismatchOnDifferentFingerprint)
+{
+  FakeSolver solver;
+  ShmIKServer server(serviceName(), solver.solveFn(), 2, solver.fingerprintFn());
+  ASSERT_TRUE(server.start());
+
+  // a client configured differently neither connects nor gets answers
+  ShmIKClient other;
+  EXPECT_FALSE(other.connect(serviceName(), fingerprint + 1));
+  std::vector<std::vector<double>> solutions;
+  EXPECT_FALSE(other.solve(poseAt(0.1), fingerprint + 1, solutions, timeout));
+  EXPECT_EQ(solver.calls, 0);
+
+  // the server changes its configuration while solving: the answer is MISMATCH and not cached
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(serviceName(), fingerprint));
+  solver.delay_ms = 100;
+  std::thread update([&solver]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    solver.fingerprint = fingerprint + 1;
+  });
+  EXPECT_FALSE(client.solve(poseAt(0.2), fingerprint, solutions, timeout));
+  update.join();
+  EXPECT_TRUE(solutions.empty());
+
+  // clients see the server's configuration through the segment, which the workers refresh in the background
+  solver.delay_ms = 0;
+  solver.fingerprint = fingerprint;
+  EXPECT_TRUE(waitFor([&]() { return client.solve(poseAt(0.2), fingerprint, solutions, timeout); }, 1.0));
+  EXPECT_EQ(solver.calls, 2);
+  EXPECT_EQ(freeSlots(serviceName()), num_slots);
+}
+
+TEST(ShmIKChannel, timeoutAbandonsSlot)
+{
+  FakeSolver solver;
+  ShmIKServer server(serviceName(), solver.solveFn(), 1, solver.fingerprintFn());
+  ASSERT_TRUE(server.start());
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(serviceName(), fingerprint));
+
+  solver.delay_ms = 200;
+  std::vector<std::vector<double>> solutions;
+  EXPECT_FALSE(client.solve(poseAt(0.1), fingerprint, solutions, 0.02));
+  EXPECT_LT(freeSlots(serviceName()), num_slots);
+
+  // the worker hands the abandoned slot back once it is done with it
+  EXPECT_TRUE(waitFor([]() { return freeSlots(serviceName()) == num_slots; }, 1.0));
+  solver.delay_ms = 0;
+  EXPECT_TRUE(client.solve(poseAt(0.2), fingerprint, solutions, timeout));
+}
+
+TEST(ShmIKChannel, reconnectsToRestartedServer)
+{
+  FakeSolver solver;
+  std::unique_ptr<ShmIKServer> server(new ShmIKServer(serviceName(), solver.solveFn(), 2, solver.fingerprintFn()));
+  ASSERT_TRUE(server->start());
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(serviceName(), fingerprint));
+
+  std::vector<std::vector<double>> solutions;
+  ASSERT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+
+  server->stop();
+  EXPECT_FALSE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+  EXPECT_FALSE(client.connected());
+
+  server.reset(new ShmIKServer(serviceName(), solver.solveFn(), 2, solver.fingerprintFn()));
+  ASSERT_TRUE(server->start());
+  EXPECT_TRUE(waitFor(
+      [&]() { return client.solve(poseAt(0.1), fingerprint, solutions, timeout); }, 3.0));
+  EXPECT_TRUE(client.connected());
+}
+
+TEST(ShmIKChannel, refusesToReplaceRunningServer)
+{
+  FakeSolver solver;
+  ShmIKServer server(serviceName(), solver.solveFn(), 1, solver.fingerprintFn());
+  ASSERT_TRUE(server.start());
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(serviceName(), fingerprint));
+
+  ShmIKServer second(serviceName(), solver.solveFn(), 1, solver.fingerprintFn());
+  EXPECT_FALSE(second.start());
+
+  std::vector<std::vector<double>> solutions;
+  EXPECT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+}
+
+TEST(ShmIKChannel, replacesSegmentOfDeadServer)
+{
+  // what a crashed server leaves behind: published, marked alive, but without a recent heartbeat
+  const std::string name = segmentName(serviceName());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(ftruncate(fd, sizeof(Segment)), 0);
+  void* addr = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(addr, MAP_FAILED);
+  Segment* dead = static_cast<Segment*>(addr);
+  dead->version = version;
+  dead->server_alive.store(1);
+  dead->heartbeat.store(0);
+  dead->magic.store(magic);
+  munmap(addr, sizeof(Segment));
+
+  FakeSolver solver;
+  ShmIKServer server(serviceName(), solver.solveFn(), 1, solver.fingerprintFn());
+  ASSERT_TRUE(server.start());
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(serviceName(), fingerprint));
+  std::vector<std::vector<double>> solutions;
+  EXPECT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+}
+
+TEST(ShmIKChannel, reclaimsSlotsOfKilledClients)
+{
+  // more clients than slots, all waiting on a slow solve when they are killed
+  const int num_clients = 70;
+  const std::string service_name = serviceName();  // the children have other pids
+
+  // forked before the server starts its threads, released through the pipe once it runs
+  int ready[2];
+  ASSERT_EQ(pipe(ready), 0);
+  std::vector<pid_t> clients;
+  for (int i = 0; i < num_clients; ++i)
+  {
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(ready[1]);
+      char go;
+      if (read(ready[0], &go, 1) != 1)
+        _exit(1);
+      ShmIKClient client;
+      client.connect(service_name, fingerprint);
+      std::vector<std::vector<double>> solutions;
+      client.solve(poseAt(i), fingerprint, solutions, timeout);
+      _exit(0);
+    }
+    ASSERT_GT(pid, 0);
+    clients.push_back(pid);
+  }
+  close(ready[0]);
+
+  FakeSolver solver;
+  solver.delay_ms = 300;
+  ShmIKServer server(service_name, solver.solveFn(), 1, solver.fingerprintFn());
+  ASSERT_TRUE(server.start());
+  const std::vector<char> go(num_clients, 1);
+  ASSERT_EQ(write(ready[1], go.data(), go.size()), static_cast<ssize_t>(go.size()));
+  close(ready[1]);
+
+  EXPECT_TRUE(waitFor([&]() { return freeSlots(service_name) == 0; }, 2.0));
+  for (std::size_t i = 0; i < clients.size(); ++i)
+    kill(clients[i], SIGKILL);
+  for (std::size_t i = 0; i < clients.size(); ++i)
+    waitpid(clients[i], nullptr, 0);
+  solver.delay_ms = 0;
+
+  // the server hands back the slots of the dead clients, healthy clients are served again
+  EXPECT_TRUE(waitFor([&]() { return freeSlots(service_name) == num_slots; }, 2.0));
+  ShmIKClient client;
+  ASSERT_TRUE(client.connect(service_name, fingerprint));
+  std::vector<std::vector<double>> solutions;
+  EXPECT_TRUE(client.solve(poseAt(0.1), fingerprint, solutions, timeout));
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}